@@ -3,103 +3,240 @@
 
 #include "Generators/BSPDungeonGenerator.h"
 
+#include "Async/ParallelFor.h"
 #include "Layouts/SimpleGridDungeonLayout.h"
 
-FRectBox::FRectBox()
+USimpleGridDungeonLayout* UBSPDungeonGenerator::GenerateLayout(const int32 Seed)
 {
+	FSimpleGridLayoutData LayoutData;
+	GenerateLayoutData(Seed, LayoutData);
+	return LayoutData.CreateLayout();
 }
 
-FRectBox::FRectBox(const FGridCoordinate InBoxOrigin, const FGridCoordinate InBoxBound)
+void UBSPDungeonGenerator::GenerateLayoutData(const int32 Seed, FSimpleGridLayoutData& OutLayoutData) const
 {
-	BoxOrigin = InBoxOrigin;
-	BoxBound = InBoxBound;
+	TArray<FBSPRoomConnection> Connections;
+	GenerateLayoutData(Seed, OutLayoutData, Connections);
 }
 
-int32 FRectBox::GetVolume() const
+void UBSPDungeonGenerator::GenerateLayoutData(const int32 Seed, FSimpleGridLayoutData& OutLayoutData, TArray<FBSPRoomConnection>& OutConnections) const
 {
-	return (BoxBound.X - BoxOrigin.X + 1) * (BoxBound.Y - BoxOrigin.Y + 1);
+	check(Settings.GridWidth > 0 && Settings.GridHeight > 0);
+	check(Settings.RoomCount > 0);
+	FDateTime StartTime = FDateTime::UtcNow();
+
+	OutLayoutData.Reset();
+	OutLayoutData.Seed = Seed;
+	OutConnections.Reset();
+	const FRectBox Area(FGridCoordinate(), FGridCoordinate(Settings.GridWidth - 1, Settings.GridHeight - 1));
+	if (Settings.bRecursiveSubdivision)
+	{
+		SubdivideRecursive(Area, Settings.RoomCount, Seed, Settings, OutLayoutData.RoomRects);
+	}
+	else
+	{
+		SubdivideWidestFirst(Area, Settings.RoomCount, Seed, Settings, OutLayoutData.RoomRects);
+	}
+
+	double TimeElapsedInMs = (FDateTime::UtcNow() - StartTime).GetTotalMilliseconds();
+	UE_LOG(LogTemp, Display, TEXT("Partitioned %dx%d tiles into %d rooms in %fms"), Settings.GridWidth, Settings.GridHeight, OutLayoutData.RoomRects.Num(), TimeElapsedInMs);
+
+	// Doors get their own stream, so where they go doesn't depend on how many numbers the subdivision drew from the room stream
+	StartTime = FDateTime::UtcNow();
+	FRandomStream ConnectionStream(static_cast<int32>(HashCombineFast(static_cast<uint32>(Seed), 1)));
+	ConnectFacingRooms(OutLayoutData.RoomRects, Settings.CorridorWidth, ConnectionStream, OutConnections);
+
+	OutLayoutData.CorridorRects.Reserve(OutConnections.Num());
+	OutLayoutData.Doors.Reserve(OutConnections.Num() * 2);
+	for (const FBSPRoomConnection& Connection : OutConnections)
+	{
+		OutLayoutData.CorridorRects.Add(Connection.Corridor);
+		OutLayoutData.Doors.Add(Connection.DoorA);
+		OutLayoutData.Doors.Add(Connection.DoorB);
+	}
+
+	TimeElapsedInMs = (FDateTime::UtcNow() - StartTime).GetTotalMilliseconds();
+	UE_LOG(LogTemp, Display, TEXT("Connected %d rooms with %d corridors in %fms"), OutLayoutData.RoomRects.Num(), OutConnections.Num(), TimeElapsedInMs);
+}
+
+void UBSPDungeonGenerator::SetGenerationSettings(const FBSPGenerationSettings& InSettings)
+{
+	Settings = InSettings;
 }
 
-TArray<FGridCoordinate> FRectBox::GetFillCoordinates() const
+void UBSPDungeonGenerator::SubdivideWidestFirst(const FRectBox& Box, const int32 RoomBudget, const int32 Seed, const FBSPGenerationSettings& InSettings, TArray<FRectBox>& OutRooms)
 {
-	TArray<FGridCoordinate> ReturnCoordinates;
+	FRandomStream RandomStream(Seed);
 
-	for (int32 X = BoxOrigin.X; X <= BoxBound.X; X++)
+	// Rooms are kept in a max-heap on their extent, so the widest room is always at the top without re-sorting
+	const auto IsWiderRoom = [](const FRectBox& A, const FRectBox& B) { return A.GetExtent() > B.GetExtent(); };
+	TArray<FRectBox> Rooms;
+	Rooms.Reserve(RoomBudget);
+	Rooms.HeapPush(Box, IsWiderRoom);
+
+	for (int i = 1; i < RoomBudget; i++)
 	{
-		for (int32 Y = BoxOrigin.Y; Y <= BoxBound.Y; Y++)
-		{
-			ReturnCoordinates.Add(FGridCoordinate(X, Y));
-		}
+		// Split the room with the largest width. If it can't be split, no narrower room can be either.
+		FRectBox BoxA;
+		FRectBox BoxB;
+		if (!ChooseRandomBoxSplit(Rooms.HeapTop(), InSettings.CorridorWidth, InSettings.MinRoomWidth, RandomStream, BoxA, BoxB)) break;
+
+		Rooms.HeapPopDiscard(IsWiderRoom);
+		Rooms.HeapPush(BoxA, IsWiderRoom);
+		Rooms.HeapPush(BoxB, IsWiderRoom);
 	}
 
-	return ReturnCoordinates;
+	// The rooms stay as rectangles, so the layout never has to store their tiles individually
+	OutRooms.Append(MoveTemp(Rooms));
 }
 
-USimpleGridDungeonLayout* UBSPDungeonGenerator::GenerateLayout()
+void UBSPDungeonGenerator::SubdivideRecursive(const FRectBox& Box, const int32 RoomBudget, const int32 Seed, const FBSPGenerationSettings& InSettings, TArray<FRectBox>& OutRooms)
 {
-	USimpleGridDungeonLayout* Layout = NewObject<USimpleGridDungeonLayout>();
+	FRandomStream RandomStream(Seed);
+	FRectBox BoxA;
+	FRectBox BoxB;
+	if (RoomBudget <= 1 || !ChooseRandomBoxSplit(Box, InSettings.CorridorWidth, InSettings.MinRoomWidth, RandomStream, BoxA, BoxB))
+	{
+		OutRooms.Add(Box);
+		return;
+	}
 
-	// Init a single large dungeon room
-	// Hardcoded to 30x30 for now, but will be configurable later
-	TArray<FRectBox> Rooms = {FRectBox(FGridCoordinate(), FGridCoordinate(9, 9))};
+	// Seeds for the two halves come from this node's stream, not a shared one, so they don't depend on the order subtrees are split in
+	const int32 SeedA = static_cast<int32>(RandomStream.GetUnsignedInt());
+	const int32 SeedB = static_cast<int32>(RandomStream.GetUnsignedInt());
 
-	constexpr int32 CorridorLength = 1;
-	constexpr int32 MinRoomWidth = 2;
+	// Share the rooms between the halves by area, leaving each at least one
+	const int64 VolumeA = BoxA.GetVolume();
+	const int64 VolumeB = BoxB.GetVolume();
+	const int32 RoomBudgetA = FMath::Clamp(static_cast<int32>((RoomBudget * VolumeA + (VolumeA + VolumeB) / 2) / (VolumeA + VolumeB)), 1, RoomBudget - 1);
+	const int32 RoomBudgetB = RoomBudget - RoomBudgetA;
 
-	constexpr int32 RoomCount = 16;
+	if (Box.GetVolume() < InSettings.ParallelSubdivisionMinArea)
+	{
+		SubdivideRecursive(BoxA, RoomBudgetA, SeedA, InSettings, OutRooms);
+		SubdivideRecursive(BoxB, RoomBudgetB, SeedB, InSettings, OutRooms);
+		return;
+	}
 
-	for (int i = 1; i < RoomCount; i++)
+	// Fork the two halves onto the task graph, then join them in a fixed order so the room order is the same as a serial split
+	TArray<FRectBox> RoomsB;
+	ParallelFor(2, [&](const int32 Half)
 	{
-		// Get the room with the largest width
-		Rooms.Sort([](const FRectBox& A, const FRectBox& B)
+		if (Half == 0)
+		{
+			SubdivideRecursive(BoxA, RoomBudgetA, SeedA, InSettings, OutRooms);
+		}
+		else
 		{
-			return (FMath::Max(A.BoxBound.X - A.BoxOrigin.X, A.BoxBound.Y - A.BoxOrigin.Y)) < (FMath::Max(B.BoxBound.X - B.BoxOrigin.X, B.BoxBound.Y - B.BoxOrigin.Y));
-		});
-		FRectBox LargestRoom = Rooms.Last();
+			SubdivideRecursive(BoxB, RoomBudgetB, SeedB, InSettings, RoomsB);
+		}
+	});
+	OutRooms.Append(MoveTemp(RoomsB));
+}
 
-		// Get possible splits of this room
-		TArray<TArray<FRectBox>> PossibleConfigurations = GetTwoRandomPossibleBoxSplits(LargestRoom, CorridorLength, MinRoomWidth);
+void UBSPDungeonGenerator::ConnectFacingRooms(const TConstArrayView<FRectBox> Rooms, const int32 CorridorWidth, FRandomStream& RandomStream, TArray<FBSPRoomConnection>& OutConnections)
+{
+	check(CorridorWidth > 0);
+	TArray<int32> RoomsByEnd;
+	TArray<int32> RoomsByStart;
+	RoomsByEnd.Reserve(Rooms.Num());
+	RoomsByStart.Reserve(Rooms.Num());
 
-		if (PossibleConfigurations.Num() == 0) break;
+	// Axis 0 finds rooms facing each other across vertical gaps, and axis 1 across horizontal gaps
+	for (int32 Axis = 0; Axis < 2; Axis++)
+	{
+		const auto Along = [Axis](const FGridCoordinate& Coordinate) { return Axis == 0 ? Coordinate.X : Coordinate.Y; };
+		const auto Across = [Axis](const FGridCoordinate& Coordinate) { return Axis == 0 ? Coordinate.Y : Coordinate.X; };
+		const auto MakeCoordinate = [Axis](const int32 AlongValue, const int32 AcrossValue) { return Axis == 0 ? FGridCoordinate(AlongValue, AcrossValue) : FGridCoordinate(AcrossValue, AlongValue); };
 
-		// Select a random split
-		PossibleConfigurations.Sort([](const TArray<FRectBox>& A, const TArray<FRectBox>& B) { return FMath::RandBool(); });
-		TArray<FRectBox> ChosenConfigurations = PossibleConfigurations.Pop();
-		
-		Rooms.Pop();
-		Rooms.Append(ChosenConfigurations);
-	}
+		// A room faces another if the gap after its far edge ends where the other room starts.
+		// Keying the rooms on either side of each gap by that line, then by where they start across it, lines up the rooms on opposite sides of every gap.
+		const auto GapEnd = [&](const int32 RoomIndex) { return Along(Rooms[RoomIndex].BoxBound) + CorridorWidth + 1; };
+		const auto RoomStart = [&](const int32 RoomIndex) { return Along(Rooms[RoomIndex].BoxOrigin); };
+		const auto SpanStart = [&](const int32 RoomIndex) { return Across(Rooms[RoomIndex].BoxOrigin); };
+		const auto SpanEnd = [&](const int32 RoomIndex) { return Across(Rooms[RoomIndex].BoxBound); };
 
-	for (FRectBox Room : Rooms)
-	{
-		Layout->AddRoomTiles(Room.GetFillCoordinates());
+		RoomsByEnd.Reset();
+		RoomsByStart.Reset();
+		for (int32 RoomIndex = 0; RoomIndex < Rooms.Num(); RoomIndex++)
+		{
+			RoomsByEnd.Add(RoomIndex);
+			RoomsByStart.Add(RoomIndex);
+		}
+		RoomsByEnd.Sort([&](const int32 A, const int32 B) { return GapEnd(A) != GapEnd(B) ? GapEnd(A) < GapEnd(B) : SpanStart(A) < SpanStart(B); });
+		RoomsByStart.Sort([&](const int32 A, const int32 B) { return RoomStart(A) != RoomStart(B) ? RoomStart(A) < RoomStart(B) : SpanStart(A) < SpanStart(B); });
+
+		// Merge the two lists. Rooms on the same side of a gap never overlap across it, so the shared spans are found like intersecting two sorted interval lists.
+		int32 EndIndex = 0;
+		int32 StartIndex = 0;
+		while (EndIndex < RoomsByEnd.Num() && StartIndex < RoomsByStart.Num())
+		{
+			const int32 RoomA = RoomsByEnd[EndIndex];
+			const int32 RoomB = RoomsByStart[StartIndex];
+			if (GapEnd(RoomA) != RoomStart(RoomB))
+			{
+				if (GapEnd(RoomA) < RoomStart(RoomB))
+				{
+					EndIndex++;
+				}
+				else
+				{
+					StartIndex++;
+				}
+				continue;
+			}
+
+			const int32 SharedStart = FMath::Max(SpanStart(RoomA), SpanStart(RoomB));
+			const int32 SharedEnd = FMath::Min(SpanEnd(RoomA), SpanEnd(RoomB));
+			if (SharedStart <= SharedEnd)
+			{
+				const int32 CorridorAcross = RandomStream.RandRange(SharedStart, SharedEnd);
+				const int32 LastInA = Along(Rooms[RoomA].BoxBound);
+				const int32 FirstInB = RoomStart(RoomB);
+
+				FBSPRoomConnection& Connection = OutConnections.AddDefaulted_GetRef();
+				Connection.RoomA = RoomA;
+				Connection.RoomB = RoomB;
+				Connection.Corridor = FRectBox(MakeCoordinate(LastInA + 1, CorridorAcross), MakeCoordinate(FirstInB - 1, CorridorAcross));
+				Connection.DoorA = FGridEdge(MakeCoordinate(LastInA, CorridorAcross), MakeCoordinate(LastInA + 1, CorridorAcross));
+				Connection.DoorB = FGridEdge(MakeCoordinate(FirstInB, CorridorAcross), MakeCoordinate(FirstInB - 1, CorridorAcross));
+			}
+
+			// Whichever span ends first can't share anything with the next room on the other side
+			if (SpanEnd(RoomA) < SpanEnd(RoomB))
+			{
+				EndIndex++;
+			}
+			else
+			{
+				StartIndex++;
+			}
+		}
 	}
-	
-	return Layout;
 }
 
-TArray<TArray<FRectBox>> UBSPDungeonGenerator::GetAllPossibleBoxSplits(const FRectBox& Box, const int32 CorridorLength, const int32 MinRoomWidth)
+TArray<TArray<FRectBox>> UBSPDungeonGenerator::GetAllPossibleBoxSplits(const FRectBox& Box, const int32 CorridorWidth, const int32 MinRoomWidth)
 {
-	check(CorridorLength > 0);
+	check(CorridorWidth > 0);
 	check(MinRoomWidth > 0);
 	TArray<TArray<FRectBox>> ReturnConfigurations;
 
 	// Iterate over every possible vertical split
-	for (int32 i = Box.BoxOrigin.X+MinRoomWidth; i <= Box.BoxBound.X - MinRoomWidth - (CorridorLength-1); i++)
+	for (int32 i = Box.BoxOrigin.X+MinRoomWidth; i <= Box.BoxBound.X - MinRoomWidth - (CorridorWidth-1); i++)
 	{
 		// Split the box at this point
 		FRectBox BoxA = FRectBox(FGridCoordinate(Box.BoxOrigin.X, Box.BoxOrigin.Y), FGridCoordinate(i-1, Box.BoxBound.Y));
-		FRectBox BoxB = FRectBox(FGridCoordinate(i+1, Box.BoxOrigin.Y), FGridCoordinate(Box.BoxBound.X, Box.BoxBound.Y));
+		FRectBox BoxB = FRectBox(FGridCoordinate(i+CorridorWidth, Box.BoxOrigin.Y), FGridCoordinate(Box.BoxBound.X, Box.BoxBound.Y));
 
 		ReturnConfigurations.Add({BoxA, BoxB});
 	}
 
 	// Iterate over every possible horizontal split
-	for (int32 i = Box.BoxOrigin.Y+MinRoomWidth; i <= Box.BoxBound.Y - MinRoomWidth - (CorridorLength-1); i++)
+	for (int32 i = Box.BoxOrigin.Y+MinRoomWidth; i <= Box.BoxBound.Y - MinRoomWidth - (CorridorWidth-1); i++)
 	{
 		// Split the box at this point
 		FRectBox BoxA = FRectBox(FGridCoordinate(Box.BoxOrigin.X, Box.BoxOrigin.Y), FGridCoordinate(Box.BoxBound.X, i-1));
-		FRectBox BoxB = FRectBox(FGridCoordinate(Box.BoxOrigin.X, i+1), FGridCoordinate(Box.BoxBound.X, Box.BoxBound.Y));
+		FRectBox BoxB = FRectBox(FGridCoordinate(Box.BoxOrigin.X, i+CorridorWidth), FGridCoordinate(Box.BoxBound.X, Box.BoxBound.Y));
 		
 		ReturnConfigurations.Add({BoxA, BoxB});
 	}
@@ -107,37 +244,36 @@ TArray<TArray<FRectBox>> UBSPDungeonGenerator::GetAllPossibleBoxSplits(const FRe
 	return ReturnConfigurations;
 }
 
-TArray<TArray<FRectBox>> UBSPDungeonGenerator::GetTwoRandomPossibleBoxSplits(const FRectBox& Box, const int32 CorridorLength, const int32 MinRoomWidth)
+bool UBSPDungeonGenerator::ChooseRandomBoxSplit(const FRectBox& Box, const int32 CorridorWidth, const int32 MinRoomWidth, FRandomStream& RandomStream, FRectBox& OutBoxA, FRectBox& OutBoxB)
 {
-	check(CorridorLength > 0);
+	check(CorridorWidth > 0);
 	check(MinRoomWidth > 0);
-	TArray<TArray<FRectBox>> ReturnConfigurations;
 
-	// Iterate over every possible vertical split
+	// The first column or row of the corridor can go anywhere that leaves both halves at least MinRoomWidth wide
 	const int32 MinX = Box.BoxOrigin.X + MinRoomWidth;
-	const int32 MaxX = Box.BoxBound.X - MinRoomWidth - (CorridorLength-1);
-	if (MinX <= MaxX)
+	const int32 MaxX = Box.BoxBound.X - MinRoomWidth - (CorridorWidth-1);
+	const int32 MinY = Box.BoxOrigin.Y + MinRoomWidth;
+	const int32 MaxY = Box.BoxBound.Y - MinRoomWidth - (CorridorWidth-1);
+	const bool bCanSplitVertically = MinX <= MaxX;
+	const bool bCanSplitHorizontally = MinY <= MaxY;
+	if (!bCanSplitVertically && !bCanSplitHorizontally)
 	{
-		const int32 SelectedX = FMath::RandRange(MinX, MaxX);
-		// Split the box at this point
-		FRectBox BoxA = FRectBox(FGridCoordinate(Box.BoxOrigin.X, Box.BoxOrigin.Y), FGridCoordinate(SelectedX-1, Box.BoxBound.Y));
-		FRectBox BoxB = FRectBox(FGridCoordinate(SelectedX+1, Box.BoxOrigin.Y), FGridCoordinate(Box.BoxBound.X, Box.BoxBound.Y));
-
-		ReturnConfigurations.Add({BoxA, BoxB});
+		return false;
 	}
 
-	// Iterate over every possible horizontal split
-	const int32 MinY = Box.BoxOrigin.Y + MinRoomWidth;
-	const int32 MaxY = Box.BoxBound.Y - MinRoomWidth - (CorridorLength-1);
-	if (MinY <= MaxY)
+	// Pick between the two directions when both are possible
+	const bool bSplitVertically = bCanSplitVertically && (!bCanSplitHorizontally || RandomStream.RandRange(0, 1) == 0);
+	if (bSplitVertically)
 	{
-		const int32 SelectedY = FMath::RandRange(MinY, MaxY);
-		// Split the box at this point
-		FRectBox BoxC = FRectBox(FGridCoordinate(Box.BoxOrigin.X, Box.BoxOrigin.Y), FGridCoordinate(Box.BoxBound.X, SelectedY-1));
-		FRectBox BoxD = FRectBox(FGridCoordinate(Box.BoxOrigin.X, SelectedY+1), FGridCoordinate(Box.BoxBound.X, Box.BoxBound.Y));
-	
-		ReturnConfigurations.Add({BoxC, BoxD});
+		const int32 SelectedX = RandomStream.RandRange(MinX, MaxX);
+		OutBoxA = FRectBox(FGridCoordinate(Box.BoxOrigin.X, Box.BoxOrigin.Y), FGridCoordinate(SelectedX-1, Box.BoxBound.Y));
+		OutBoxB = FRectBox(FGridCoordinate(SelectedX+CorridorWidth, Box.BoxOrigin.Y), FGridCoordinate(Box.BoxBound.X, Box.BoxBound.Y));
 	}
-
-	return ReturnConfigurations;
-}
\ No newline at end of file
+	else
+	{
+		const int32 SelectedY = RandomStream.RandRange(MinY, MaxY);
+		OutBoxA = FRectBox(FGridCoordinate(Box.BoxOrigin.X, Box.BoxOrigin.Y), FGridCoordinate(Box.BoxBound.X, SelectedY-1));
+		OutBoxB = FRectBox(FGridCoordinate(Box.BoxOrigin.X, SelectedY+CorridorWidth), FGridCoordinate(Box.BoxBound.X, Box.BoxBound.Y));
+	}
+	return true;
+}
@@ -0,0 +1,431 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Generators/RoomOffsetCacheSubsystem.h"
+
+#include "Algo/BinarySearch.h"
+#include "Engine/Engine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace
+{
+	constexpr uint32 CacheFileMagic = 0x44464F43; // "DFOC"
+	constexpr int32 CacheFileVersion = 3;
+	constexpr int32 MaxSerializedCount = 1 << 20;
+
+	void SerializeCoordinates(FArchive& Ar, TArray<FGridCoordinate>& Coordinates)
+	{
+		int32 NumCoordinates = Coordinates.Num();
+		Ar << NumCoordinates;
+		if (Ar.IsLoading())
+		{
+			if (NumCoordinates < 0 || NumCoordinates > MaxSerializedCount)
+			{
+				Ar.SetError();
+				return;
+			}
+			Coordinates.SetNum(NumCoordinates);
+		}
+		for (FGridCoordinate& Coordinate : Coordinates)
+		{
+			Ar << Coordinate.X << Coordinate.Y;
+		}
+	}
+
+	/**
+	 * Stores a table of per-pair offsets back to back, with the start of each pair's span followed by the total as the final start.
+	 */
+	void FlattenPairTable(const TArray<TArray<FGridCoordinate>>& OffsetsPerPair, TArray<FGridCoordinate>& OutOffsets, TArray<int32>& OutStarts)
+	{
+		int32 NumOffsets = 0;
+		for (const TArray<FGridCoordinate>& Offsets : OffsetsPerPair)
+		{
+			NumOffsets += Offsets.Num();
+		}
+
+		OutOffsets.Reset(NumOffsets);
+		OutStarts.Reset(OffsetsPerPair.Num() + 1);
+		for (const TArray<FGridCoordinate>& Offsets : OffsetsPerPair)
+		{
+			OutStarts.Add(OutOffsets.Num());
+			OutOffsets.Append(Offsets);
+		}
+		OutStarts.Add(OutOffsets.Num());
+	}
+
+	/**
+	 * Reads or writes a flat pair table.
+	 * @return False if a loaded table doesn't have a start for every pair of NumShapes shapes, or its starts don't describe valid spans of Offsets.
+	 */
+	bool SerializePairTable(FArchive& Ar, const int32 NumShapes, TArray<FGridCoordinate>& Offsets, TArray<int32>& Starts)
+	{
+		SerializeCoordinates(Ar, Offsets);
+		if (Ar.IsError()) return false;
+
+		int32 NumStarts = Starts.Num();
+		Ar << NumStarts;
+		if (Ar.IsLoading())
+		{
+			if (NumStarts < 0 || NumStarts > MaxSerializedCount)
+			{
+				Ar.SetError();
+				return false;
+			}
+			Starts.SetNum(NumStarts);
+		}
+		for (int32& Start : Starts)
+		{
+			Ar << Start;
+		}
+		if (Ar.IsError()) return false;
+
+		bool bValidStarts = Starts.Num() == static_cast<int64>(NumShapes) * NumShapes + 1 && Starts[0] == 0 && Starts.Last() == Offsets.Num();
+		for (int32 i = 1; bValidStarts && i < Starts.Num(); i++)
+		{
+			bValidStarts = Starts[i - 1] <= Starts[i];
+		}
+		return bValidStarts;
+	}
+}
+
+TSharedRef<FRoomShapeCatalogue> FRoomShapeCatalogue::Build(const TArray<FDungeonRoom>& InShapes)
+{
+	return Build(InternShapes(InShapes));
+}
+
+TSharedRef<FRoomShapeCatalogue> FRoomShapeCatalogue::Build(TArray<TArray<FGridCoordinate>>&& InShapeTiles)
+{
+	TSharedRef<FRoomShapeCatalogue> Catalogue = MakeShared<FRoomShapeCatalogue>();
+	Catalogue->ShapeTiles = MoveTemp(InShapeTiles);
+	Catalogue->ContentHash = ComputeContentHash(Catalogue->ShapeTiles);
+
+	Catalogue->BuildPairTables();
+	Catalogue->BuildDerivedData();
+	return Catalogue;
+}
+
+TArray<TArray<FGridCoordinate>> FRoomShapeCatalogue::InternShapes(const TArray<FDungeonRoom>& InShapes)
+{
+	TArray<TArray<FGridCoordinate>> OutShapeTiles;
+	OutShapeTiles.Reserve(InShapes.Num());
+	for (const FDungeonRoom& Shape : InShapes)
+	{
+		// Sets have no defined order, so sort the tiles to get the same list for the same shape
+		TArray<FGridCoordinate>& Tiles = OutShapeTiles.Add_GetRef(Shape.LocalCoordOffsets.Array());
+		Tiles.Sort();
+	}
+	return OutShapeTiles;
+}
+
+uint32 FRoomShapeCatalogue::ComputeContentHash(const TArray<TArray<FGridCoordinate>>& InShapeTiles)
+{
+	uint32 Hash = GetTypeHash(InShapeTiles.Num());
+	for (const TArray<FGridCoordinate>& Tiles : InShapeTiles)
+	{
+		Hash = HashCombineFast(Hash, GetTypeHash(Tiles.Num()));
+		for (const FGridCoordinate& Tile : Tiles)
+		{
+			Hash = HashCombineFast(Hash, GetTypeHash(Tile));
+		}
+	}
+	return Hash;
+}
+
+void FRoomShapeCatalogue::Serialize(FArchive& Ar)
+{
+	Ar << ContentHash;
+
+	int32 NumSerializedShapes = ShapeTiles.Num();
+	Ar << NumSerializedShapes;
+	if (Ar.IsLoading())
+	{
+		if (NumSerializedShapes < 0 || NumSerializedShapes > MaxSerializedCount)
+		{
+			Ar.SetError();
+			return;
+		}
+		ShapeTiles.SetNum(NumSerializedShapes);
+	}
+
+	for (TArray<FGridCoordinate>& Tiles : ShapeTiles)
+	{
+		SerializeCoordinates(Ar, Tiles);
+		if (Ar.IsError()) return;
+	}
+
+	const bool bValidPairOffsets = SerializePairTable(Ar, NumSerializedShapes, PairOffsets, PairOffsetStarts);
+	const bool bValidBlockedOffsets = SerializePairTable(Ar, NumSerializedShapes, BlockedOffsets, BlockedOffsetStarts);
+
+	if (Ar.IsLoading() && !Ar.IsError())
+	{
+		// The derived data indexes the tables by their starts, so tables that don't match the shapes are rebuilt rather than trusted
+		if (!bValidPairOffsets || !bValidBlockedOffsets)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Rebuilding the invalid pair offset tables of a cached room offset catalogue of %d shapes"), NumSerializedShapes);
+			BuildPairTables();
+		}
+		BuildDerivedData();
+	}
+}
+
+void FRoomShapeCatalogue::BuildPairTables()
+{
+	const int32 NumShapes = ShapeTiles.Num();
+	TArray<TArray<FGridCoordinate>> OffsetsPerPair;
+	TArray<TArray<FGridCoordinate>> BlockedOffsetsPerPair;
+	OffsetsPerPair.SetNum(NumShapes * NumShapes);
+	BlockedOffsetsPerPair.SetNum(NumShapes * NumShapes);
+	TBitArray<> bContainsOrigin;
+	for (const TArray<FGridCoordinate>& Tiles : ShapeTiles)
+	{
+		bContainsOrigin.Add(Algo::BinarySearch(Tiles, FGridCoordinate(0, 0)) != INDEX_NONE);
+	}
+	for (int32 ShapeA = 0; ShapeA < NumShapes; ShapeA++)
+	{
+		for (int32 ShapeB = 0; ShapeB < NumShapes; ShapeB++)
+		{
+			BlockedOffsetsPerPair[ShapeA * NumShapes + ShapeB] = USimpleGridDungeonGenerator::GenerateBlockedOffsetsForRooms(ShapeTiles[ShapeA], ShapeTiles[ShapeB]);
+		}
+
+		// The offsets for B to A are just the inverse of the offsets for A to B, so each unordered pair is only generated once.
+		// That only holds when both shapes contain their origin, because then the origin check is already covered by the overlap check.
+		for (int32 ShapeB = ShapeA; ShapeB < NumShapes; ShapeB++)
+		{
+			TArray<FGridCoordinate>& AToBOffsets = OffsetsPerPair[ShapeA * NumShapes + ShapeB];
+			AToBOffsets = USimpleGridDungeonGenerator::GenerateOffsetsForRooms(ShapeTiles[ShapeA], ShapeTiles[ShapeB]);
+			if (ShapeA == ShapeB) continue;
+
+			if (!bContainsOrigin[ShapeA] || !bContainsOrigin[ShapeB])
+			{
+				OffsetsPerPair[ShapeB * NumShapes + ShapeA] = USimpleGridDungeonGenerator::GenerateOffsetsForRooms(ShapeTiles[ShapeB], ShapeTiles[ShapeA]);
+				continue;
+			}
+
+			TArray<FGridCoordinate>& BToAOffsets = OffsetsPerPair[ShapeB * NumShapes + ShapeA];
+			BToAOffsets.Reserve(AToBOffsets.Num());
+			for (const FGridCoordinate& Offset : AToBOffsets)
+			{
+				BToAOffsets.Add(Offset.Inverse());
+			}
+			BToAOffsets.Sort();
+		}
+	}
+
+	FlattenPairTable(OffsetsPerPair, PairOffsets, PairOffsetStarts);
+	FlattenPairTable(BlockedOffsetsPerPair, BlockedOffsets, BlockedOffsetStarts);
+}
+
+void FRoomShapeCatalogue::BuildDerivedData()
+{
+	Footprints.Reset(ShapeTiles.Num());
+	for (const TArray<FGridCoordinate>& Tiles : ShapeTiles)
+	{
+		FShapeFootprint& Footprint = Footprints.AddDefaulted_GetRef();
+		if (Tiles.Num() == 0) continue;
+
+		FGridCoordinate Min = Tiles[0];
+		FGridCoordinate Max = Tiles[0];
+		for (const FGridCoordinate& Tile : Tiles)
+		{
+			Min = FGridCoordinate(FMath::Min(Min.X, Tile.X), FMath::Min(Min.Y, Tile.Y));
+			Max = FGridCoordinate(FMath::Max(Max.X, Tile.X), FMath::Max(Max.Y, Tile.Y));
+		}
+		checkf(Max.X - Min.X < 64, TEXT("Room shapes wider than 64 tiles can't be stored as row masks"));
+
+		Footprint.BottomLeft = Min;
+		Footprint.RowMasks.SetNumZeroed(Max.Y - Min.Y + 1);
+		for (const FGridCoordinate& Tile : Tiles)
+		{
+			Footprint.RowMasks[Tile.Y - Min.Y] |= 1ull << (Tile.X - Min.X);
+		}
+	}
+
+	// Walls go wherever the neighbouring tile is outside the shape
+	ShapePerimeters.Reset(ShapeTiles.Num());
+	for (const TArray<FGridCoordinate>& Tiles : ShapeTiles)
+	{
+		TArray<FGridEdge>& Perimeter = ShapePerimeters.AddDefaulted_GetRef();
+		for (const FGridCoordinate& Tile : Tiles)
+		{
+			UGridCoordinateHelperLibrary::ForEachAdjacentCoordinate(Tile, [&](const FGridCoordinate& AdjacentTile)
+			{
+				if (Algo::BinarySearch(Tiles, AdjacentTile) != INDEX_NONE) return;
+				Perimeter.Add(FGridEdge(AdjacentTile, Tile));
+			});
+		}
+	}
+
+	// Doors can go on any edge between B at the offset and A, both taken relative to A's origin
+	DoorCandidates.Reset();
+	DoorCandidateStarts.Reset(PairOffsets.Num() + 1);
+	const int32 NumPairs = NumShapes() * NumShapes();
+	for (int32 PairIndex = 0; PairIndex < NumPairs; PairIndex++)
+	{
+		const TArray<FGridCoordinate>& TilesA = ShapeTiles[PairIndex / NumShapes()];
+		const TArray<FGridCoordinate>& TilesB = ShapeTiles[PairIndex % NumShapes()];
+		for (int32 OffsetIndex = PairOffsetStarts[PairIndex]; OffsetIndex < PairOffsetStarts[PairIndex + 1]; OffsetIndex++)
+		{
+			DoorCandidateStarts.Add(DoorCandidates.Num());
+			for (const FGridCoordinate& LocalTileB : TilesB)
+			{
+				// A tile of B in a notch of A touches it twice. The last neighbour in adjacency order gets the door, as it always has.
+				const FGridCoordinate TileB = LocalTileB + PairOffsets[OffsetIndex];
+				FGridCoordinate TileA;
+				bool bTouchesA = false;
+				UGridCoordinateHelperLibrary::ForEachAdjacentCoordinate(TileB, [&](const FGridCoordinate& AdjacentTile)
+				{
+					if (Algo::BinarySearch(TilesA, AdjacentTile) == INDEX_NONE) return;
+					TileA = AdjacentTile;
+					bTouchesA = true;
+				});
+				if (bTouchesA)
+				{
+					DoorCandidates.Add(FGridEdge(TileB, TileA));
+				}
+			}
+		}
+	}
+	DoorCandidateStarts.Add(DoorCandidates.Num());
+}
+
+void URoomOffsetCacheSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	if (bPersistToDisk)
+	{
+		LoadFromDisk();
+	}
+}
+
+void URoomOffsetCacheSubsystem::Deinitialize()
+{
+	if (bPersistToDisk && bHasUnsavedCatalogues)
+	{
+		SaveToDisk();
+	}
+
+	Super::Deinitialize();
+}
+
+TSharedRef<const FRoomShapeCatalogue> URoomOffsetCacheSubsystem::FindOrBuildCatalogue(const TArray<FDungeonRoom>& Shapes)
+{
+	TArray<TArray<FGridCoordinate>> ShapeTiles = FRoomShapeCatalogue::InternShapes(Shapes);
+	const uint32 ContentHash = FRoomShapeCatalogue::ComputeContentHash(ShapeTiles);
+
+	FScopeLock Lock(&CacheLock);
+	TArray<TSharedRef<FRoomShapeCatalogue>>& CataloguesWithHash = Catalogues.FindOrAdd(ContentHash);
+	for (const TSharedRef<FRoomShapeCatalogue>& Catalogue : CataloguesWithHash)
+	{
+		// Compare the shapes themselves in case of a hash collision
+		if (Catalogue->ShapeTiles == ShapeTiles)
+		{
+			return Catalogue;
+		}
+	}
+
+	const FDateTime StartTime = FDateTime::UtcNow();
+	TSharedRef<FRoomShapeCatalogue> NewCatalogue = FRoomShapeCatalogue::Build(MoveTemp(ShapeTiles));
+	UE_LOG(LogTemp, Display, TEXT("Built room offset catalogue of %d shapes in %fms"), Shapes.Num(), (FDateTime::UtcNow() - StartTime).GetTotalMilliseconds());
+
+	CataloguesWithHash.Add(NewCatalogue);
+	bHasUnsavedCatalogues = true;
+	return NewCatalogue;
+}
+
+TSharedRef<const FRoomShapeCatalogue> URoomOffsetCacheSubsystem::GetCatalogue(const TArray<FDungeonRoom>& Shapes)
+{
+	if (GEngine)
+	{
+		if (URoomOffsetCacheSubsystem* Cache = GEngine->GetEngineSubsystem<URoomOffsetCacheSubsystem>())
+		{
+			return Cache->FindOrBuildCatalogue(Shapes);
+		}
+	}
+	return FRoomShapeCatalogue::Build(Shapes);
+}
+
+void URoomOffsetCacheSubsystem::SaveToDisk()
+{
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+
+	FScopeLock Lock(&CacheLock);
+	uint32 Magic = CacheFileMagic;
+	int32 Version = CacheFileVersion;
+	int32 NumCatalogues = 0;
+	for (const TPair<uint32, TArray<TSharedRef<FRoomShapeCatalogue>>>& Pair : Catalogues)
+	{
+		NumCatalogues += Pair.Value.Num();
+	}
+	Writer << Magic << Version << NumCatalogues;
+
+	for (const TPair<uint32, TArray<TSharedRef<FRoomShapeCatalogue>>>& Pair : Catalogues)
+	{
+		for (const TSharedRef<FRoomShapeCatalogue>& Catalogue : Pair.Value)
+		{
+			Catalogue->Serialize(Writer);
+		}
+	}
+
+	if (FFileHelper::SaveArrayToFile(Bytes, *GetCacheFilePath()))
+	{
+		bHasUnsavedCatalogues = false;
+		UE_LOG(LogTemp, Display, TEXT("Saved %d room offset catalogues to %s"), NumCatalogues, *GetCacheFilePath());
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Failed to save room offset catalogues to %s"), *GetCacheFilePath());
+	}
+}
+
+FString URoomOffsetCacheSubsystem::GetCacheFilePath() const
+{
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("DungeonForge"), TEXT("RoomOffsetCache.bin"));
+}
+
+void URoomOffsetCacheSubsystem::LoadFromDisk()
+{
+	TArray<uint8> Bytes;
+	if (!FFileHelper::LoadFileToArray(Bytes, *GetCacheFilePath(), FILEREAD_Silent))
+	{
+		return;
+	}
+
+	FMemoryReader Reader(Bytes);
+	uint32 Magic = 0;
+	int32 Version = 0;
+	int32 NumCatalogues = 0;
+	Reader << Magic << Version << NumCatalogues;
+	if (Reader.IsError() || Magic != CacheFileMagic || Version != CacheFileVersion || NumCatalogues < 0 || NumCatalogues > MaxSerializedCount)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Ignoring out of date room offset cache %s"), *GetCacheFilePath());
+		return;
+	}
+
+	TArray<TSharedRef<FRoomShapeCatalogue>> LoadedCatalogues;
+	for (int32 i = 0; i < NumCatalogues && !Reader.IsError(); i++)
+	{
+		TSharedRef<FRoomShapeCatalogue> Catalogue = MakeShared<FRoomShapeCatalogue>();
+		Catalogue->Serialize(Reader);
+		// Rehash rather than trusting the stored hash, so a change to the hash function can't leave catalogues unreachable
+		Catalogue->ContentHash = FRoomShapeCatalogue::ComputeContentHash(Catalogue->ShapeTiles);
+		LoadedCatalogues.Add(Catalogue);
+	}
+
+	if (Reader.IsError())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Ignoring corrupt room offset cache %s"), *GetCacheFilePath());
+		return;
+	}
+
+	FScopeLock Lock(&CacheLock);
+	for (const TSharedRef<FRoomShapeCatalogue>& Catalogue : LoadedCatalogues)
+	{
+		Catalogues.FindOrAdd(Catalogue->ContentHash).Add(Catalogue);
+	}
+	UE_LOG(LogTemp, Display, TEXT("Loaded %d room offset catalogues from %s"), LoadedCatalogues.Num(), *GetCacheFilePath());
+}
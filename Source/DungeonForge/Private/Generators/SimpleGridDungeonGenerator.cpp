@@ -4,7 +4,11 @@
 // ReSharper disable All
 #include "Generators/SimpleGridDungeonGenerator.h"
 
-#include "Generators/BSPDungeonGenerator.h"
+#include "Algo/BinarySearch.h"
+#include "Async/ParallelFor.h"
+#include "Generators/RoomOffsetCacheSubsystem.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Layouts/GridTileBitmap.h"
 #include "Layouts/SimpleGridDungeonLayout.h"
 
 FDungeonRoom::FDungeonRoom()
@@ -74,96 +78,157 @@ bool FDungeonRoom::AreRoomsTouching(const FDungeonRoom& A, const FDungeonRoom& B
 
 	for (const FGridCoordinate Coord : B.LocalCoordOffsets)
 	{
-		for (FGridCoordinate AdjacentCoord : UGridCoordinateHelperLibrary::GetAdjacentCoordinates(Coord+B.GlobalCentre, false))
+		if (UGridCoordinateHelperLibrary::AnyAdjacentCoordinate(Coord+B.GlobalCentre, [&ACoords](const FGridCoordinate& AdjacentCoord) { return ACoords.Contains(AdjacentCoord); }))
 		{
-			if (ACoords.Contains(AdjacentCoord))
-			{
-				return true;
-			}
+			return true;
 		}
 	}
 	return false;
 }
 
-USimpleGridDungeonLayout* USimpleGridDungeonGenerator::GenerateLayout()
-{	
-	USimpleGridDungeonLayout* Layout = NewObject<USimpleGridDungeonLayout>();
-	
-	TArray<FDungeonRoom> RoomLayout = {};
-	TSet<FGridCoordinate> RoomLayoutUsedCoords;
+void FRoomPlacementFrontier::Add(const FGridCoordinate& Origin, const int32 ParentRoomIndex, const int32 PairOffsetIndex)
+{
+	if (CandidateIndices.Contains(Origin)) return;
+	CandidateIndices.Add(Origin, Candidates.Add({Origin, ParentRoomIndex, PairOffsetIndex}));
+}
+
+void FRoomPlacementFrontier::Remove(const FGridCoordinate& Origin)
+{
+	int32 Index;
+	if (!CandidateIndices.RemoveAndCopyValue(Origin, Index)) return;
+
+	// Move the last candidate into the gap, and update its index to match
+	Candidates.RemoveAtSwap(Index);
+	if (Index < Candidates.Num())
+	{
+		CandidateIndices[Candidates[Index].Origin] = Index;
+	}
+}
+
+void FRoomPlacementFrontier::Reset()
+{
+	Candidates.Reset();
+	CandidateIndices.Reset();
+}
+
+void FSimpleGridGenerationScratch::Reset(const int32 NumShapes)
+{
+	PossibleShapeIds.Reset();
+	RoomLayout.Reset();
+	RoomLayoutUsedCoords.Reset();
+	Frontiers.SetNum(NumShapes);
+	for (FRoomPlacementFrontier& Frontier : Frontiers)
+	{
+		Frontier.Reset();
+	}
+	RoomConnections.Reset();
+}
+
+USimpleGridDungeonLayout* USimpleGridDungeonGenerator::GenerateLayout(const int32 Seed)
+{
+	FSimpleGridGenerationScratch Scratch;
+	Scratch.bParallelPlacement = bParallelPlacement;
+	FSimpleGridLayoutData LayoutData;
+
+	const FDateTime StartTime = FDateTime::UtcNow();
+	GenerateLayoutData(Seed, Scratch, LayoutData);
+	UE_LOG(LogTemp, Warning, TEXT("Total sampled possible rooms for actual generation: %d"), Scratch.PossibleShapeIds.Num());
+	UE_LOG(LogTemp, Log, TEXT("Placed %d rooms in %f milliseconds"), Scratch.RoomLayout.Num(), (FDateTime::UtcNow() - StartTime).GetTotalMilliseconds());
+
+	FlushPersistentDebugLines(GetWorld());
+	return LayoutData.CreateLayout();
+}
+
+void USimpleGridDungeonGenerator::GenerateLayoutData(const int32 Seed, FSimpleGridGenerationScratch& Scratch, FSimpleGridLayoutData& OutLayoutData) const
+{
+	check(Catalogue.IsValid());
+	Scratch.Reset(Catalogue->NumShapes());
+	OutLayoutData.Reset();
+	OutLayoutData.Seed = Seed;
+	FRandomStream RandomStream(Seed);
+
+	// Populate PossibleShapeIds with a sample of the catalogue's layouts (just squares, rectangles and L shapes for now)
+	SamplePossibleShapes(Catalogue->NumShapes(), RandomStream, Scratch.PossibleShapeIds);
 
 	// Add a single room to the layout, needed to place all the rest
-	int StartingRoomIndex = 0;
-	FDungeonRoom StartingRoom = FDungeonRoom(FGridCoordinate(0,0), PossibleRooms[StartingRoomIndex].LocalCoordOffsets);
-	RoomLayout.Add(StartingRoom);
-	RoomLayoutUsedCoords.Append(StartingRoom.GetGlobalCoordOffsets());
+	PlaceRoom({Scratch.PossibleShapeIds[0], FGridCoordinate(0,0)}, Scratch);
 
-	TMap<FDungeonRoom, FDungeonRoom> RoomConnections;
 	// Place one less than the NumRooms, since we already added the first room
 	check(RoomCount >= 1)
 	for (int i = 1; i < RoomCount; i++)
 	{
-		AddSingleRoomToLayout(RoomLayout, RoomLayoutUsedCoords, RoomConnections);
+		AddSingleRoomToLayout(Scratch, RandomStream);
 	}
 	
-	// RoomLayout should be a list of all the rooms in the dungeon. Now we have to convert that to a USimpleGridDungeonLayout
-	for (FDungeonRoom Room : RoomLayout)
+	// RoomLayout should be a list of all the rooms in the dungeon. Now we have to convert that to layout data
+	for (const FPlacedRoom& Room : Scratch.RoomLayout)
 	{
-		TSet<FGridEdge> WallEdges;
-		for (FGridCoordinate Coord : Room.LocalCoordOffsets)
+		// Tiles and walls are the shape's templates translated to the room's origin
+		for (const FGridCoordinate& Coord : Catalogue->GetShapeTiles(Room.ShapeId))
 		{
-			Layout->AddRoomTiles({Coord+Room.GlobalCentre});
-
-			for (FGridCoordinate AdjacentCoord : UGridCoordinateHelperLibrary::GetAdjacentCoordinates(Coord+Room.GlobalCentre))
-			{
-				if (Room.GetGlobalCoordOffsets().Contains(AdjacentCoord)) continue;
-				WallEdges.Add({AdjacentCoord, Coord+Room.GlobalCentre});
-			}
+			OutLayoutData.RoomTiles.Add(Coord+Room.Origin);
 		}
-
-		for (const auto& Edge : WallEdges)
+		for (const FGridEdge& Edge : Catalogue->GetShapePerimeter(Room.ShapeId))
 		{
-			Layout->AddWalls({Edge});
+			OutLayoutData.Walls.Add(FGridEdge(Edge.CoordinateA+Room.Origin, Edge.CoordinateB+Room.Origin));
 		}
 	}
 
-	Layout->bImputesWallPositions = false;
+	OutLayoutData.bImputesWallPositions = false;
 
-	FlushPersistentDebugLines(GetWorld());
 	// Add doors between the rooms
-	for (TTuple<FDungeonRoom, FDungeonRoom> Connection : RoomConnections)
+	OutLayoutData.Doors.Reserve(Scratch.RoomConnections.Num());
+	for (const FRoomConnection& Connection : Scratch.RoomConnections)
+	{
+		// Pick a random door from the candidates for this pair of shapes at this offset
+		const FGridCoordinate& ParentOrigin = Scratch.RoomLayout[Connection.ParentRoomIndex].Origin;
+		const TConstArrayView<FGridEdge> DoorCandidates = Catalogue->GetDoorCandidates(Connection.PairOffsetIndex);
+		const FGridEdge& Door = DoorCandidates[RandomStream.RandRange(0, DoorCandidates.Num() - 1)];
+		OutLayoutData.Doors.Add(FGridEdge(Door.CoordinateA+ParentOrigin, Door.CoordinateB+ParentOrigin));
+	}
+}
+
+TArray<FSimpleGridLayoutData> USimpleGridDungeonGenerator::GenerateLayoutBatch(const int32 FirstSeed, const int32 NumLayouts, const int32 MaxWorkers) const
+{
+	TArray<FSimpleGridLayoutData> OutLayouts;
+	OutLayouts.SetNum(NumLayouts);
+
+	const FDateTime StartTime = FDateTime::UtcNow();
+	const int32 NumThreads = MaxWorkers > 0 ? MaxWorkers : FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+	TArray<FSimpleGridGenerationScratch> WorkerScratches;
+	WorkerScratches.SetNum(FMath::Clamp(NumLayouts, 1, NumThreads));
+
+	// Each worker takes the next layout until there are none left, so a slow layout doesn't hold up a fixed share of the batch
+	FThreadSafeCounter NextLayoutIndex;
+	ParallelFor(WorkerScratches.Num(), [this, FirstSeed, NumLayouts, &OutLayouts, &WorkerScratches, &NextLayoutIndex](const int32 WorkerIndex)
 	{
-		// Find tiles with an adjacent tile in the other room
-		TMap<FGridCoordinate, FGridCoordinate> PotentialDoorTiles;
-		for (const FGridCoordinate Coord : Connection.Key.GetGlobalCoordOffsets())
+		FSimpleGridGenerationScratch& Scratch = WorkerScratches[WorkerIndex];
+		// Every layout already has a worker to itself, so the placements within it stay on that worker
+		Scratch.bParallelPlacement = false;
+		for (int32 LayoutIndex = NextLayoutIndex.Add(1); LayoutIndex < NumLayouts; LayoutIndex = NextLayoutIndex.Add(1))
 		{
-			for (const FGridCoordinate AdjacentCoord : UGridCoordinateHelperLibrary::GetAdjacentCoordinates(Coord))
-			{
-				if (Connection.Value.GetGlobalCoordOffsets().Contains(AdjacentCoord))
-				{
-					PotentialDoorTiles.Add(Coord, AdjacentCoord);
-				}
-			}
+			// Wrap rather than overflow if the seed range runs past the largest seed
+			const int32 Seed = static_cast<int32>(static_cast<uint32>(FirstSeed) + static_cast<uint32>(LayoutIndex));
+			GenerateLayoutData(Seed, Scratch, OutLayouts[LayoutIndex]);
 		}
-		// Pick a random tile to place the door
-		TArray<FGridCoordinate> Keys;
-		PotentialDoorTiles.GetKeys(Keys);
-		const FGridCoordinate DoorTile = Keys[FMath::RandRange(0, Keys.Num() - 1)];
-		const FGridCoordinate DoorTarget = PotentialDoorTiles[DoorTile];
-		Layout->AddDoors({FGridEdge(DoorTile, DoorTarget)});
-	}
+	});
 	
-	return Layout;
+	const double TimeElapsedInMs = (FDateTime::UtcNow() - StartTime).GetTotalMilliseconds();
+	UE_LOG(LogTemp, Display, TEXT("Generated %d layouts on %d workers in %fms (%f layouts per second)"), NumLayouts, WorkerScratches.Num(), TimeElapsedInMs, TimeElapsedInMs > 0.0 ? NumLayouts * 1000.0 / TimeElapsedInMs : 0.0);
+	return OutLayouts;
 }
 
 void USimpleGridDungeonGenerator::SetNumRooms(const int32 InRoomCount)
 {
 	RoomCount = InRoomCount;
 	
-	// Populate PotentialRooms with some layouts (just squares and rectangles for now)
-	PossibleRooms = InitPossibleRooms();
-	// Calculate every possible combination of two rooms.
-	RoomComboOffsetsMap = GenerateRoomComboOffsets(PossibleRooms);
+	// The offsets between every combination of two rooms only depend on the shapes, so they are shared through the engine-wide cache
+	Catalogue = URoomOffsetCacheSubsystem::GetCatalogue(InitPossibleRooms());
+}
+
+void USimpleGridDungeonGenerator::SetParallelPlacement(const bool bInParallelPlacement)
+{
+	bParallelPlacement = bInParallelPlacement;
 }
 
 TArray<FDungeonRoom> USimpleGridDungeonGenerator::InitPossibleRooms()
@@ -207,140 +272,180 @@ TArray<FDungeonRoom> USimpleGridDungeonGenerator::InitPossibleRooms()
 	AllRooms.Add(FDungeonRoom(FGridCoordinate(0,0), (UGridCoordinateHelperLibrary::RotateClockwise(LRoom1, 3))));
 	
 	UE_LOG(LogTemp, Warning, TEXT("Total generated possible rooms: %d"), AllRooms.Num());
+	return AllRooms;
+}
 
+void USimpleGridDungeonGenerator::SamplePossibleShapes(const int32 NumShapes, FRandomStream& RandomStream, TArray<int32>& OutShapeIds)
+{
 	// Since there can be a huge number of possible rooms, we reduce the number of sampled rooms to improve performance
 	// TODO set equal to number of rooms
 	int MaxRoomsInGen = 12;
-	MaxRoomsInGen = FMath::Min(MaxRoomsInGen, AllRooms.Num());
+	MaxRoomsInGen = FMath::Min(MaxRoomsInGen, NumShapes);
 
-	// Shuffle the rooms
-	AllRooms.Sort([](const FDungeonRoom& A, const FDungeonRoom& B) { return FMath::RandBool(); });
-	TArray<FDungeonRoom> OutPossibleRooms = {};
-	
-	// Adds a random selection of rooms into the possible rooms
-	for (int i = 0; i < MaxRoomsInGen; i++)
+	// Shuffle the shape IDs
+	OutShapeIds.Reset(NumShapes);
+	for (int32 ShapeId = 0; ShapeId < NumShapes; ShapeId++)
 	{
-		OutPossibleRooms.Add(AllRooms[i]);
+		OutShapeIds.Add(ShapeId);
 	}
-	
-	UE_LOG(LogTemp, Warning, TEXT("Total sampled possible rooms for actual generation: %d"), OutPossibleRooms.Num());
-	return OutPossibleRooms;
+	for (int32 i = NumShapes - 1; i > 0; i--)
+	{
+		OutShapeIds.Swap(i, RandomStream.RandRange(0, i));
+	}
+
+	// Keep a random selection of shapes as the possible shapes
+	OutShapeIds.SetNum(MaxRoomsInGen);
 }
 
-TMap<TTuple<FDungeonRoom, FDungeonRoom>, TSet<FGridCoordinate>> USimpleGridDungeonGenerator::GenerateRoomComboOffsets(const TArray<FDungeonRoom>& Rooms)
+TArray<FGridCoordinate> USimpleGridDungeonGenerator::GenerateOffsetsForRooms(const TConstArrayView<FGridCoordinate> RoomA, const TConstArrayView<FGridCoordinate> RoomB)
 {
-	TMap<TTuple<FDungeonRoom, FDungeonRoom>, TSet<FGridCoordinate>> OutRoomComboOffsets = {};
-	
-	// Iterates over every room, and adds coord offsets from one room to the other
-	for (const FDungeonRoom RoomA : Rooms)
+	// B placed at offset O overlaps A when O = a - b for some tiles a and b, i.e. O is in the Minkowski sum of A and the reflection of B.
+	// B touches A when O = n - b for some tile n orthogonally next to A, so the touching offsets are the same sum taken
+	// over A dilated by one tile, minus the overlapping offsets.
+	FGridTileBitmap RoomATiles;
+	RoomATiles.Append(RoomA);
+
+	FGridTileBitmap DilatedRoomATiles = RoomATiles;
+	for (int32 DirectionIndex = 0; DirectionIndex < UGridCoordinateHelperLibrary::NumOrthogonalDirections; DirectionIndex++)
 	{
-		for (const FDungeonRoom RoomB : Rooms)
-		{
-			// Since we calculate inverses to rooms below, it is possible that the offsets have already been calculated and added to the map.
-			if (OutRoomComboOffsets.Contains(TTuple<FDungeonRoom, FDungeonRoom>(RoomA, RoomB))) continue;
-			
-			const TSet<FGridCoordinate> ItoJOffsets = GenerateOffsetsForRooms(RoomA.LocalCoordOffsets, RoomB.LocalCoordOffsets);
-			OutRoomComboOffsets.Add(TTuple<FDungeonRoom, FDungeonRoom>(RoomA, RoomB), ItoJOffsets);
-			
-			// The offsets for the other room to itself should just be the inverse of its own generated offsets
-			TSet<FGridCoordinate> JtoIOffsets;
-			for (FGridCoordinate Offset : ItoJOffsets)
-			{
-				JtoIOffsets.Add(Offset.Inverse());
-			}
-			OutRoomComboOffsets.Add(TTuple<FDungeonRoom, FDungeonRoom>(RoomB, RoomA), JtoIOffsets);
-		}
+		DilatedRoomATiles.UnionTranslated(RoomATiles, FGridCoordinate(UGridCoordinateHelperLibrary::DirectionOffsetX[DirectionIndex], UGridCoordinateHelperLibrary::DirectionOffsetY[DirectionIndex]));
 	}
-	
-	return OutRoomComboOffsets;
+
+	FGridTileBitmap OverlappingOffsets;
+	FGridTileBitmap TouchingOffsets;
+	for (const FGridCoordinate& Coord : RoomB)
+	{
+		OverlappingOffsets.UnionTranslated(RoomATiles, Coord.Inverse());
+		TouchingOffsets.UnionTranslated(DilatedRoomATiles, Coord.Inverse());
+	}
+	TouchingOffsets.Difference(OverlappingOffsets);
+
+	// Offsets which put B's origin inside A are never used
+	TouchingOffsets.Difference(RoomATiles);
+
+	TArray<FGridCoordinate> OutOffsets = TouchingOffsets.Array();
+	OutOffsets.Sort();
+	return OutOffsets;
 }
 
-TSet<FGridCoordinate> USimpleGridDungeonGenerator::GenerateOffsetsForRooms(const TSet<FGridCoordinate>& RoomA, const TSet<FGridCoordinate>& RoomB)
+TArray<FGridCoordinate> USimpleGridDungeonGenerator::GenerateBlockedOffsetsForRooms(const TConstArrayView<FGridCoordinate> RoomA, const TConstArrayView<FGridCoordinate> RoomB)
 {
-	TSet<FGridCoordinate> OutArray;
+	// The same Minkowski sum of A and the reflection of B as the overlapping offsets above, plus A itself for the origin check
+	FGridTileBitmap RoomATiles;
+	RoomATiles.Append(RoomA);
 
-	const int MaxBFSRange = FDungeonRoom::MaxManhattanDistanceBetweenRooms(RoomA, RoomB);
+	FGridTileBitmap BlockedOffsets = RoomATiles;
+	for (const FGridCoordinate& Coord : RoomB)
+	{
+		BlockedOffsets.UnionTranslated(RoomATiles, Coord.Inverse());
+	}
+
+	TArray<FGridCoordinate> OutOffsets = BlockedOffsets.Array();
+	OutOffsets.Sort();
+	return OutOffsets;
+}
+
+void USimpleGridDungeonGenerator::AddSingleRoomToLayout(FSimpleGridGenerationScratch& Scratch, FRandomStream& RandomStream) const
+{
+	// Take a new random room shape
+	const int32 NewShapeId = Scratch.PossibleShapeIds[RandomStream.RandRange(0,Scratch.PossibleShapeIds.Num()-1)];
+
+	// The frontier already holds every origin where this shape touches an existing room without overlapping any
+	const FRoomPlacementFrontier& Frontier = Scratch.Frontiers[NewShapeId];
+	if (Frontier.Num() == 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("No valid placement left for room shape %d"), NewShapeId);
+		return;
+	}
 
-	const FDungeonRoom RoomADungeonRoom = FDungeonRoom(FGridCoordinate(), RoomA);
-	FDungeonRoom RoomBDungeonRoom = FDungeonRoom(FGridCoordinate(), RoomB);
+	// Select a random location to place the new room
+	const FRoomPlacementFrontier::FCandidate Candidate = Frontier.Candidates[RandomStream.RandRange(0, Frontier.Num() - 1)];
+	Scratch.RoomConnections.Add({Scratch.RoomLayout.Num(), Candidate.ParentRoomIndex, Candidate.PairOffsetIndex});
+	PlaceRoom({NewShapeId, Candidate.Origin}, Scratch);
+}
 
-	TSet<FGridCoordinate> VisitedCoords;
-	TQueue<FGridCoordinate> SearchQueue;
-	SearchQueue.Enqueue(FGridCoordinate(0,0));
-	VisitedCoords.Add(FGridCoordinate(0,0));
+void USimpleGridDungeonGenerator::PlaceRoom(const FPlacedRoom& Room, FSimpleGridGenerationScratch& Scratch) const
+{
+	const int32 RoomIndex = Scratch.RoomLayout.Add(Room);
 
-	const TSet<FGridCoordinate> RoomACoords = TSet(RoomA);
-	int CurrentRange = 0;
-	while (CurrentRange <= MaxBFSRange)
+	// Update global set of coord tiles
+	for (const FGridCoordinate& Coord : Catalogue->GetShapeTiles(Room.ShapeId))
 	{
-		// Take top item from queue
-		FGridCoordinate CurrentCoord;
-		SearchQueue.Dequeue(CurrentCoord);
+		Scratch.RoomLayoutUsedCoords.Add(Coord+Room.Origin);
+	}
 
-		// Only process if current coord not in RoomA
-		if (!RoomACoords.Contains(CurrentCoord))
+	// Candidates that would overlap the new room are no longer valid
+	for (const int32 ShapeId : Scratch.PossibleShapeIds)
+	{
+		FRoomPlacementFrontier& Frontier = Scratch.Frontiers[ShapeId];
+		for (const FGridCoordinate& BlockedOffset : Catalogue->GetBlockedOffsets(Room.ShapeId, ShapeId))
 		{
-			CurrentRange = CurrentCoord.X + CurrentCoord.Y;
-			
-			RoomBDungeonRoom.GlobalCentre = CurrentCoord;
-			if (FDungeonRoom::AreRoomsTouching(RoomADungeonRoom, RoomBDungeonRoom))
-			{
-				OutArray.Add(CurrentCoord);
-			}
+			Frontier.Remove(Room.Origin + BlockedOffset);
 		}
+	}
 
-		// Add all neighbors to queue
-		for (FGridCoordinate AdjacentCoord : UGridCoordinateHelperLibrary::GetAdjacentCoordinates(CurrentCoord, true))
-		{
-			if (!VisitedCoords.Contains(AdjacentCoord))
-			{
-				VisitedCoords.Add(AdjacentCoord);
-				SearchQueue.Enqueue(AdjacentCoord);
-			}
-		}		
+	// Positions touching the new room become candidates, as long as they don't overlap an earlier room. The offsets of every
+	// shape are laid end to end so they can be split evenly, whichever shapes they belong to.
+	Scratch.PlacementOffsetStarts.Reset();
+	int32 NumOffsets = 0;
+	for (const int32 ShapeId : Scratch.PossibleShapeIds)
+	{
+		Scratch.PlacementOffsetStarts.Add(NumOffsets);
+		NumOffsets += Catalogue->GetPairOffsets(Room.ShapeId, ShapeId).Num();
 	}
-	return OutArray;
-}
+	Scratch.PlacementOffsetStarts.Add(NumOffsets);
 
-void USimpleGridDungeonGenerator::AddSingleRoomToLayout(TArray<FDungeonRoom>& RoomLayout, TSet<FGridCoordinate>& RoomLayoutUsedCoords, TMap<FDungeonRoom, FDungeonRoom>& RoomConnections) const
-{
-	// Take a new random room layout
-	const int NewRoomIndex = FMath::RandRange(0,PossibleRooms.Num()-1);
-	FDungeonRoom NewRoom = PossibleRooms[NewRoomIndex];
+	// Too few offsets per shard and the tasks cost more than the overlap tests they run
+	constexpr int32 MinOffsetsPerShard = 64;
+	const int32 MaxWorkers = Scratch.MaxPlacementWorkers > 0 ? Scratch.MaxPlacementWorkers : FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+	const int32 NumShards = Scratch.bParallelPlacement ? FMath::Clamp(NumOffsets / MinOffsetsPerShard, 1, MaxWorkers) : 1;
+	if (Scratch.ShardCandidates.Num() < NumShards)
+	{
+		Scratch.ShardCandidates.SetNum(NumShards);
+	}
 
-	// Find every existing room and their PossibleRooms index
-	TMap<FGridCoordinate, FDungeonRoom> PlaceableLocations;
-	for (FDungeonRoom ExistingRoom : RoomLayout)
+	// Shards only read the frontiers and the occupancy, and each writes its own buffer
+	ParallelFor(NumShards, [&](const int32 ShardIndex)
 	{
-		// Find all placeable points
-		const TTuple<FDungeonRoom, FDungeonRoom> MapKey = TTuple<FDungeonRoom, FDungeonRoom>(FDungeonRoom(FGridCoordinate(), ExistingRoom.LocalCoordOffsets), NewRoom);
-		for (FGridCoordinate RoomOffset : RoomComboOffsetsMap[MapKey])
+		TArray<FSimpleGridGenerationScratch::FPlacementCandidate>& Candidates = Scratch.ShardCandidates[ShardIndex];
+		Candidates.Reset();
+
+		const int32 FirstOffset = static_cast<int32>(static_cast<int64>(NumOffsets) * ShardIndex / NumShards);
+		const int32 EndOffset = static_cast<int32>(static_cast<int64>(NumOffsets) * (ShardIndex + 1) / NumShards);
+		int32 PossibleShapeIndex = Algo::UpperBound(Scratch.PlacementOffsetStarts, FirstOffset) - 1;
+		for (int32 FlatOffsetIndex = FirstOffset; FlatOffsetIndex < EndOffset; FlatOffsetIndex++)
 		{
-			const FGridCoordinate NewRoomGlobalOrigin = ExistingRoom.GlobalCentre + RoomOffset;
-			
-			// Filter out origins that are already used (quick check because we already have a set)
-			if (RoomLayoutUsedCoords.Contains(NewRoomGlobalOrigin)) continue;
-
-			// If none of the coordinates of the placement of the new room are already used, then we can place the new room at this RoomOffset
-			const FDungeonRoom NewRoomInGlobalSpace = FDungeonRoom(NewRoomGlobalOrigin, NewRoom.LocalCoordOffsets);
-			if (NewRoomInGlobalSpace.GetGlobalCoordOffsets().Intersect(RoomLayoutUsedCoords).Num() == 0)
+			while (FlatOffsetIndex >= Scratch.PlacementOffsetStarts[PossibleShapeIndex + 1])
 			{
-				PlaceableLocations.Add(NewRoomGlobalOrigin, ExistingRoom);
+				PossibleShapeIndex++;
+			}
+			const int32 ShapeId = Scratch.PossibleShapeIds[PossibleShapeIndex];
+			const int32 OffsetIndex = FlatOffsetIndex - Scratch.PlacementOffsetStarts[PossibleShapeIndex];
+			const FGridCoordinate Origin = Room.Origin + Catalogue->GetPairOffsets(Room.ShapeId, ShapeId)[OffsetIndex];
+			if (Scratch.Frontiers[ShapeId].Contains(Origin)) continue;
+			if (CanPlaceShape(ShapeId, Origin, Scratch.RoomLayoutUsedCoords))
+			{
+				Candidates.Add({ShapeId, Origin, Catalogue->GetPairOffsetsStart(Room.ShapeId, ShapeId) + OffsetIndex});
 			}
 		}
+	}, NumShards > 1 ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+
+	// The shards are contiguous, so merging them in order adds the candidates in the same order as a single pass
+	for (int32 ShardIndex = 0; ShardIndex < NumShards; ShardIndex++)
+	{
+		for (const FSimpleGridGenerationScratch::FPlacementCandidate& Candidate : Scratch.ShardCandidates[ShardIndex])
+		{
+			Scratch.Frontiers[Candidate.ShapeId].Add(Candidate.Origin, RoomIndex, Candidate.PairOffsetIndex);
+		}
 	}
+}
 
-	// Select a random location to place the new room
-	TArray<FGridCoordinate> ListOfSpawnLocations;
-	PlaceableLocations.GetKeys(ListOfSpawnLocations);
-	const FGridCoordinate RoomCentre = ListOfSpawnLocations[FMath::RandRange(0, ListOfSpawnLocations.Num() - 1)];
-	
-	NewRoom.GlobalCentre = RoomCentre;
-	RoomLayout.Add(NewRoom);
-	RoomConnections.Add(NewRoom, PlaceableLocations[RoomCentre]);
-	
-	// Update global set of coord tiles
-	RoomLayoutUsedCoords.Append(NewRoom.GetGlobalCoordOffsets());
+bool USimpleGridDungeonGenerator::CanPlaceShape(const int32 ShapeId, const FGridCoordinate& Origin, const FGridTileBitmap& RoomLayoutUsedCoords) const
+{
+	// Quick check on the origin first, because it often lands on a used tile
+	if (RoomLayoutUsedCoords.Contains(Origin)) return false;
+	const FRoomShapeCatalogue::FShapeFootprint& Footprint = Catalogue->GetFootprint(ShapeId);
+	return !RoomLayoutUsedCoords.IntersectsRows(Footprint.RowMasks, Origin + Footprint.BottomLeft);
 }
 
 USimpleGridDungeonLayout* USimpleGridDungeonGenerator::SimpleStaticLayout1()
@@ -380,13 +485,13 @@ USimpleGridDungeonLayout* USimpleGridDungeonGenerator::SimpleStaticLayout1()
 	// Add doors between corridor and room boundaries
 	for (FGridCoordinate CorridorCoord : Layout->GetCorridorTiles())
 	{
-		for (FGridCoordinate AdjacentCoord : UGridCoordinateHelperLibrary::GetAdjacentCoordinates(CorridorCoord))
+		UGridCoordinateHelperLibrary::ForEachAdjacentCoordinate(CorridorCoord, [Layout, &CorridorCoord](const FGridCoordinate& AdjacentCoord)
 		{
-			if (Layout->GetRoomTiles().Contains(AdjacentCoord))
+			if (Layout->IsRoomTile(AdjacentCoord))
 			{
 				Layout->AddDoors({FGridEdge(CorridorCoord, AdjacentCoord)});
 			}
-		}
+		});
 	}
 	
 	return Layout;
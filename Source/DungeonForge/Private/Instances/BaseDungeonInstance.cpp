@@ -3,15 +3,103 @@
 
 #include "Instances/BaseDungeonInstance.h"
 
+#include "Async/Async.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "Layouts/SimpleGridDungeonLayout.h"
+
+namespace
+{
+	/**
+	 * The sum of an edge's two tiles is twice the edge's midpoint, so it is unique per edge.
+	 */
+	uint64 GetEdgeKey(const FGridEdge& Edge)
+	{
+		return FGridCoordinate(Edge.CoordinateA.X + Edge.CoordinateB.X, Edge.CoordinateA.Y + Edge.CoordinateB.Y).GetPackedKey();
+	}
+
+	/**
+	 * The sum of a corner's four tiles is four times the corner's position, so it is unique per corner.
+	 */
+	uint64 GetCornerKey(const FGridCorner& Corner)
+	{
+		return FGridCoordinate(
+			Corner.CoordinateA.X + Corner.CoordinateB.X + Corner.CoordinateC.X + Corner.CoordinateD.X,
+			Corner.CoordinateA.Y + Corner.CoordinateB.Y + Corner.CoordinateC.Y + Corner.CoordinateD.Y).GetPackedKey();
+	}
+
+	/**
+	 * The inverse of GetEdgeKey, for edges between orthogonal neighbours. The coordinates come out sorted, like FGridEdge's constructor sorts them.
+	 */
+	FGridEdge GetEdgeFromKey(const uint64 Key)
+	{
+		const FGridCoordinate Sum = FGridCoordinate::FromPackedKey(Key);
+		if (Sum.X & 1)
+		{
+			const FGridCoordinate CoordinateA((Sum.X - 1) / 2, Sum.Y / 2);
+			return FGridEdge(CoordinateA, FGridCoordinate(CoordinateA.X + 1, CoordinateA.Y));
+		}
+		const FGridCoordinate CoordinateA(Sum.X / 2, (Sum.Y - 1) / 2);
+		return FGridEdge(CoordinateA, FGridCoordinate(CoordinateA.X, CoordinateA.Y + 1));
+	}
+
+	/**
+	 * The inverse of GetCornerKey. The sum of the four tiles is four times the bottom-left tile plus (2, 2).
+	 */
+	FGridCorner GetCornerFromKey(const uint64 Key)
+	{
+		const FGridCoordinate Sum = FGridCoordinate::FromPackedKey(Key);
+		return FGridCorner::FromVertex(FGridCoordinate((Sum.X - 2) / 4, (Sum.Y - 2) / 4));
+	}
+
+	/**
+	 * @return How many tiles are summed into each key of the category, so the key divided by this is the instance's grid position.
+	 */
+	int32 GetTilesPerKey(const EDungeonMeshCategory Category)
+	{
+		switch (Category)
+		{
+		case EDungeonMeshCategory::Wall:
+		case EDungeonMeshCategory::Door:
+			return 2;
+		case EDungeonMeshCategory::Pillar:
+			return 4;
+		default:
+			return 1;
+		}
+	}
+
+	int32 FloorDivide(const int32 Dividend, const int32 Divisor)
+	{
+		return (Dividend >= 0 ? Dividend : Dividend - Divisor + 1) / Divisor;
+	}
+}
 
 // Sets default values
 ABaseDungeonInstance::ABaseDungeonInstance()
 {
-	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
+	// Only ticks while a time-sliced spawn is in progress, or while streaming
 	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.bStartWithTickEnabled = false;
 
 	SceneRoot = CreateDefaultSubobject<USceneComponent>("Scene Root");
 	SetRootComponent(SceneRoot);
+
+	Layout = CreateDefaultSubobject<USimpleGridDungeonLayout>("Dungeon Layout");
+
+	// One instanced component per category, so spawning is a bulk add per category and clearing is O(1) in the number of components
+	RoomFloorMeshISM = CreateDefaultSubobject<UInstancedStaticMeshComponent>("FloorMeshISM");
+	RoomFloorMeshISM->SetupAttachment(RootComponent);
+	CorridorFloorMeshISM = CreateDefaultSubobject<UInstancedStaticMeshComponent>("CorridorFloorMeshISM");
+	CorridorFloorMeshISM->SetupAttachment(RootComponent);
+	WallMeshISM = CreateDefaultSubobject<UInstancedStaticMeshComponent>("WallMeshISM");
+	WallMeshISM->SetupAttachment(RootComponent);
+	DoorMeshISM = CreateDefaultSubobject<UInstancedStaticMeshComponent>("DoorMeshISM");
+	DoorMeshISM->SetupAttachment(RootComponent);
+	PillarMeshISM = CreateDefaultSubobject<UInstancedStaticMeshComponent>("PillarMeshISM");
+	PillarMeshISM->SetupAttachment(RootComponent);
 }
 
 void ABaseDungeonInstance::GenerateLayout()
@@ -20,6 +108,81 @@ void ABaseDungeonInstance::GenerateLayout()
 
 void ABaseDungeonInstance::SpawnDungeon()
 {
+	CancelSpawning();
+	if (!Layout) return;
+
+	const FDateTime StartTime = FDateTime::UtcNow();
+	if (FMath::Max(CellSize, 0) != SpawnedCellSize)
+	{
+		// The spawned instances are bucketed by the old cells, so there is nothing to diff against
+		ReleaseAllBuckets();
+		SpawnedCellSize = FMath::Max(CellSize, 0);
+	}
+	// Time slicing and streaming rely on ticking, which only happens in game worlds, so the editor shows the whole dungeon
+	// unless streaming is asked for outside game worlds, where it is driven by calling UpdateStreaming
+	const bool bGameWorld = GetWorld() && GetWorld()->IsGameWorld();
+	bStreamingCells = bStreamCells && SpawnedCellSize > 0 && (bGameWorld || bStreamOutsideGameWorlds);
+	bQueueSpawnInstances = bTimeSlicedSpawning && bGameWorld && !bStreamingCells;
+
+	// When streaming, the spawn functions only sort the instances into StreamingCells, and UpdateStreaming spawns the cells near the players
+	StreamingCells.Reset();
+	bResubmitLoadedCells = true;
+	if (!bStreamingCells)
+	{
+		LoadedCellKeys.Reset();
+	}
+
+	// Spawn all floor tiles
+	SpawnRoomFloorTiles();
+	SpawnCorridorFloorTiles();
+	SpawnWallTiles();
+	SpawnDoorTiles();
+	SpawnCornerPillars();
+	if (bStreamingCells && bAutoUpdateStreaming)
+	{
+		UpdateStreaming(GetViewerLocations());
+		StreamingUpdateCountdown = StreamingUpdateInterval;
+		SetActorTickEnabled(true);
+	}
+	else if (bStreamingCells)
+	{
+		UpdateStreaming(LastViewerLocations);
+	}
+
+	// Without cells every category goes into a single instanced component, so the component count doesn't grow with the dungeon
+	TInlineComponentArray<UPrimitiveComponent*> PrimitiveComponents(this);
+	int32 NumInstances = PendingSpawnInstances.Num();
+	for (const TMap<uint64, FInstanceBucket>& Buckets : SpawnedBuckets)
+	{
+		for (const TPair<uint64, FInstanceBucket>& Pair : Buckets)
+		{
+			NumInstances += Pair.Value.InstanceKeys.Num();
+		}
+	}
+	UE_LOG(LogTemp, Display, TEXT("Spawned %d instances across %d primitive components in %fms"), NumInstances, PrimitiveComponents.Num(), (FDateTime::UtcNow() - StartTime).GetTotalMilliseconds());
+
+	if (!bQueueSpawnInstances)
+	{
+		OnDungeonSpawned.Broadcast();
+		return;
+	}
+	bQueueSpawnInstances = false;
+
+	// Spawn the instances nearest the players first. Instance transforms are relative to the dungeon, so the players' locations are too.
+	const TArray<FVector> LocalViewerLocations = GetLocalViewerLocations(GetViewerLocations());
+	for (FPendingSpawnInstance& Instance : PendingSpawnInstances)
+	{
+		Instance.DistanceSquared = TNumericLimits<double>::Max();
+		for (const FVector& ViewerLocation : LocalViewerLocations)
+		{
+			Instance.DistanceSquared = FMath::Min(Instance.DistanceSquared, FVector::DistSquared(Instance.Transform.GetLocation(), ViewerLocation));
+		}
+	}
+	PendingSpawnInstances.StableSort([](const FPendingSpawnInstance& A, const FPendingSpawnInstance& B) { return A.DistanceSquared < B.DistanceSquared; });
+
+	// Start this frame, then carry on each tick until everything is spawned
+	SetActorTickEnabled(true);
+	SpawnPendingInstances(SpawnBudgetMs);
 }
 
 void ABaseDungeonInstance::GenerateDungeon()
@@ -28,6 +191,137 @@ void ABaseDungeonInstance::GenerateDungeon()
 
 void ABaseDungeonInstance::ClearDungeon()
 {
+	bStreamingCells = false;
+	StreamingCells.Reset();
+	CancelSpawning();
+	ReleaseAllBuckets();
+	// Also clears instances no bucket tracks, such as the ones loaded with the level
+	for (int32 CategoryIndex = 0; CategoryIndex < static_cast<int32>(EDungeonMeshCategory::Num); CategoryIndex++)
+	{
+		GetCategoryComponent(static_cast<EDungeonMeshCategory>(CategoryIndex))->ClearInstances();
+	}
+	Layout = nullptr;
+}
+
+FGridCoordinate ABaseDungeonInstance::GetCellForCoordinate(const FGridCoordinate& Coordinate) const
+{
+	if (SpawnedCellSize <= 0) return FGridCoordinate(0, 0);
+	return FGridCoordinate(FloorDivide(Coordinate.X, SpawnedCellSize), FloorDivide(Coordinate.Y, SpawnedCellSize));
+}
+
+void ABaseDungeonInstance::SetCellEnabled(const FGridCoordinate& Cell, const bool bEnabled)
+{
+	const uint64 CellKey = Cell.GetPackedKey();
+	if (bEnabled)
+	{
+		DisabledCellKeys.Remove(CellKey);
+	}
+	else
+	{
+		DisabledCellKeys.Add(CellKey);
+	}
+	if (SpawnedCellSize <= 0) return;
+
+	for (int32 CategoryIndex = 0; CategoryIndex < static_cast<int32>(EDungeonMeshCategory::Num); CategoryIndex++)
+	{
+		if (const FInstanceBucket* Bucket = SpawnedBuckets[CategoryIndex].Find(CellKey))
+		{
+			ApplyCellEnabled(Bucket->Component, static_cast<EDungeonMeshCategory>(CategoryIndex), bEnabled);
+		}
+	}
+}
+
+bool ABaseDungeonInstance::IsCellEnabled(const FGridCoordinate& Cell) const
+{
+	return !DisabledCellKeys.Contains(Cell.GetPackedKey());
+}
+
+void ABaseDungeonInstance::GenerateDungeonAsync()
+{
+	CancelDungeonGeneration();
+
+	TUniqueFunction<void(FSimpleGridLayoutData&)> LayoutGenerator = MakeAsyncLayoutGenerator(GetGenerationSeed());
+	if (!LayoutGenerator)
+	{
+		GenerateDungeon();
+		OnDungeonGenerated.Broadcast();
+		return;
+	}
+
+	TSharedRef<FThreadSafeBool, ESPMode::ThreadSafe> Cancelled = MakeShared<FThreadSafeBool, ESPMode::ThreadSafe>(false);
+	AsyncGenerationCancelled = Cancelled;
+	TWeakObjectPtr<ABaseDungeonInstance> WeakThis(this);
+	Async(EAsyncExecution::ThreadPool, [LayoutGenerator = MoveTemp(LayoutGenerator), Cancelled, WeakThis]() mutable
+	{
+		TSharedRef<FSimpleGridLayoutData, ESPMode::ThreadSafe> LayoutData = MakeShared<FSimpleGridLayoutData, ESPMode::ThreadSafe>();
+		const FDateTime StartTime = FDateTime::UtcNow();
+		if (!*Cancelled)
+		{
+			LayoutGenerator(*LayoutData);
+			UE_LOG(LogTemp, Display, TEXT("Generated layout in the background in %fms"), (FDateTime::UtcNow() - StartTime).GetTotalMilliseconds());
+		}
+
+		// The generator is handed back to the game thread to be destroyed, since it may hold references to UObjects
+		AsyncTask(ENamedThreads::GameThread, [LayoutGenerator = MoveTemp(LayoutGenerator), LayoutData, Cancelled, WeakThis]()
+		{
+			ABaseDungeonInstance* Instance = WeakThis.Get();
+			if (!Instance || *Cancelled) return;
+			Instance->FinishAsyncGeneration(*LayoutData);
+		});
+	});
+}
+
+void ABaseDungeonInstance::CancelDungeonGeneration()
+{
+	if (AsyncGenerationCancelled.IsValid())
+	{
+		*AsyncGenerationCancelled = true;
+		AsyncGenerationCancelled.Reset();
+	}
+}
+
+bool ABaseDungeonInstance::IsGeneratingDungeon() const
+{
+	return AsyncGenerationCancelled.IsValid();
+}
+
+TUniqueFunction<void(FSimpleGridLayoutData&)> ABaseDungeonInstance::MakeAsyncLayoutGenerator(int32 GenerationSeed)
+{
+	return nullptr;
+}
+
+void ABaseDungeonInstance::ApplyLayoutData(const FSimpleGridLayoutData& LayoutData)
+{
+	Layout = LayoutData.CreateLayout(this);
+}
+
+void ABaseDungeonInstance::FinishAsyncGeneration(const FSimpleGridLayoutData& LayoutData)
+{
+	AsyncGenerationCancelled.Reset();
+
+	const FDateTime StartTime = FDateTime::UtcNow();
+	PrepareForRespawn();
+	ApplyLayoutData(LayoutData);
+	SpawnDungeon();
+	UE_LOG(LogTemp, Log, TEXT("Spawned async generated dungeon in %f milliseconds"), (FDateTime::UtcNow() - StartTime).GetTotalMilliseconds());
+
+	OnDungeonGenerated.Broadcast();
+}
+
+void ABaseDungeonInstance::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	CancelDungeonGeneration();
+	Super::EndPlay(EndPlayReason);
+}
+
+int32 ABaseDungeonInstance::GetGenerationSeed()
+{
+	if (bRandomiseSeed)
+	{
+		Seed = FMath::Rand();
+	}
+	UE_LOG(LogTemp, Display, TEXT("Generating dungeon with seed %d"), Seed);
+	return Seed;
 }
 
 // Called when the game starts or when spawned
@@ -36,3 +330,700 @@ void ABaseDungeonInstance::BeginPlay()
 	Super::BeginPlay();
 	
 }
+
+void ABaseDungeonInstance::Tick(const float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	if (IsSpawningDungeon())
+	{
+		SpawnPendingInstances(SpawnBudgetMs);
+	}
+
+	if (bStreamingCells && bAutoUpdateStreaming)
+	{
+		StreamingUpdateCountdown -= DeltaSeconds;
+		if (StreamingUpdateCountdown <= 0.0f)
+		{
+			StreamingUpdateCountdown = StreamingUpdateInterval;
+			UpdateStreaming(GetViewerLocations());
+		}
+	}
+}
+
+bool ABaseDungeonInstance::IsSpawningDungeon() const
+{
+	return NextPendingSpawnIndex < PendingSpawnInstances.Num();
+}
+
+void ABaseDungeonInstance::AddSpawnInstances(const EDungeonMeshCategory Category, const uint64 CellKey, const TArray<uint64>& Keys, const TArray<FTransform>& Transforms)
+{
+	check(Keys.Num() == Transforms.Num());
+	if (Transforms.Num() == 0) return;
+	if (!bQueueSpawnInstances)
+	{
+		FInstanceBucket& Bucket = FindOrAddBucket(Category, CellKey);
+		Bucket.Component->AddInstances(Transforms, false);
+		Bucket.InstanceKeys.Append(Keys);
+		return;
+	}
+
+	PendingSpawnInstances.Reserve(PendingSpawnInstances.Num() + Transforms.Num());
+	for (int32 Index = 0; Index < Transforms.Num(); Index++)
+	{
+		PendingSpawnInstances.Add({Category, CellKey, Keys[Index], Transforms[Index], 0.0});
+	}
+}
+
+void ABaseDungeonInstance::SpawnPendingInstances(const double BudgetMs)
+{
+	// Check the clock once per batch rather than once per instance
+	constexpr int32 SpawnBatchSize = 128;
+	const double EndTime = FPlatformTime::Seconds() + BudgetMs / 1000.0;
+
+	// Instances are sorted by distance rather than bucket, so group each batch by bucket to add it in one call per component
+	struct FBucketBatch
+	{
+		EDungeonMeshCategory Category;
+		uint64 CellKey;
+		TArray<uint64> Keys;
+		TArray<FTransform> Transforms;
+	};
+	TArray<FBucketBatch, TInlineAllocator<16>> BucketBatches;
+	do
+	{
+		const int32 BatchEnd = FMath::Min(NextPendingSpawnIndex + SpawnBatchSize, PendingSpawnInstances.Num());
+		for (; NextPendingSpawnIndex < BatchEnd; NextPendingSpawnIndex++)
+		{
+			const FPendingSpawnInstance& Instance = PendingSpawnInstances[NextPendingSpawnIndex];
+			FBucketBatch* BucketBatch = BucketBatches.FindByPredicate([&Instance](const FBucketBatch& Batch) { return Batch.Category == Instance.Category && Batch.CellKey == Instance.CellKey; });
+			if (!BucketBatch)
+			{
+				BucketBatch = &BucketBatches.Add_GetRef({Instance.Category, Instance.CellKey, {}, {}});
+			}
+			BucketBatch->Keys.Add(Instance.Key);
+			BucketBatch->Transforms.Add(Instance.Transform);
+		}
+
+		for (FBucketBatch& BucketBatch : BucketBatches)
+		{
+			if (BucketBatch.Transforms.Num() == 0) continue;
+			FInstanceBucket& Bucket = FindOrAddBucket(BucketBatch.Category, BucketBatch.CellKey);
+			Bucket.Component->AddInstances(BucketBatch.Transforms, false);
+			Bucket.InstanceKeys.Append(BucketBatch.Keys);
+			BucketBatch.Keys.Reset();
+			BucketBatch.Transforms.Reset();
+		}
+	}
+	while (IsSpawningDungeon() && FPlatformTime::Seconds() < EndTime);
+
+	OnDungeonSpawnProgress.Broadcast(PendingSpawnInstances.Num() > 0 ? static_cast<float>(NextPendingSpawnIndex) / PendingSpawnInstances.Num() : 1.0f);
+	if (!IsSpawningDungeon())
+	{
+		FinishSpawning();
+	}
+}
+
+void ABaseDungeonInstance::FinishSpawning()
+{
+	UE_LOG(LogTemp, Log, TEXT("Finished time-sliced spawn of %d instances"), PendingSpawnInstances.Num());
+	CancelSpawning();
+	OnDungeonSpawned.Broadcast();
+}
+
+void ABaseDungeonInstance::CancelSpawning()
+{
+	PendingSpawnInstances.Empty();
+	NextPendingSpawnIndex = 0;
+	SetActorTickEnabled(bStreamingCells);
+}
+
+TArray<FVector> ABaseDungeonInstance::GetViewerLocations() const
+{
+	TArray<FVector> ViewerLocations;
+	if (const UWorld* World = GetWorld())
+	{
+		for (FConstPlayerControllerIterator It = World->GetPlayerControllerIterator(); It; ++It)
+		{
+			if (const APlayerController* PlayerController = It->Get())
+			{
+				FVector ViewLocation;
+				FRotator ViewRotation;
+				PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+				ViewerLocations.Add(ViewLocation);
+			}
+		}
+	}
+
+	if (ViewerLocations.Num() == 0)
+	{
+		ViewerLocations.Add(GetActorLocation());
+	}
+	return ViewerLocations;
+}
+
+TArray<FVector> ABaseDungeonInstance::GetLocalViewerLocations(const TArray<FVector>& ViewerLocations) const
+{
+	const FTransform& ActorTransform = GetActorTransform();
+	TArray<FVector> LocalViewerLocations;
+	LocalViewerLocations.Reserve(ViewerLocations.Num());
+	for (const FVector& ViewerLocation : ViewerLocations)
+	{
+		LocalViewerLocations.Add(ActorTransform.InverseTransformPosition(ViewerLocation));
+	}
+	return LocalViewerLocations;
+}
+
+void ABaseDungeonInstance::SpawnRoomFloorTiles()
+{
+	TArray<uint64> RoomFloorKeys;
+	RoomFloorKeys.Reserve(Layout->GetNumFloorTiles());
+	Layout->ForEachRoomTile([&RoomFloorKeys](const FGridCoordinate& Coordinate)
+	{
+		RoomFloorKeys.Add(Coordinate.GetPackedKey());
+	});
+	RoomFloorMeshISM->SetStaticMesh(RoomFloorMesh);
+	SubmitInstances(EDungeonMeshCategory::RoomFloor, RoomFloorKeys);
+}
+
+void ABaseDungeonInstance::SpawnCorridorFloorTiles()
+{
+	TArray<uint64> CorridorFloorKeys;
+	Layout->ForEachCorridorTile([&CorridorFloorKeys](const FGridCoordinate& Coordinate)
+	{
+		CorridorFloorKeys.Add(Coordinate.GetPackedKey());
+	});
+	CorridorFloorMeshISM->SetStaticMesh(CorridorFloorMesh);
+	SubmitInstances(EDungeonMeshCategory::CorridorFloor, CorridorFloorKeys);
+}
+
+void ABaseDungeonInstance::SpawnWallTiles()
+{
+	TArray<uint64> WallKeys;
+	WallKeys.Reserve(Layout->ViewWallPositions().Num());
+	for (const FGridEdge& Edge : Layout->ViewWallPositions())
+	{
+		WallKeys.Add(GetEdgeKey(Edge));
+	}
+	WallMeshISM->SetStaticMesh(WallMesh);
+	SubmitInstances(EDungeonMeshCategory::Wall, WallKeys);
+}
+
+void ABaseDungeonInstance::SpawnDoorTiles()
+{
+	TArray<uint64> DoorKeys;
+	DoorKeys.Reserve(Layout->ViewDoorPositions().Num());
+	for (const FGridEdge& Edge : Layout->ViewDoorPositions())
+	{
+		DoorKeys.Add(GetEdgeKey(Edge));
+	}
+	DoorMeshISM->SetStaticMesh(DoorMesh);
+	SubmitInstances(EDungeonMeshCategory::Door, DoorKeys);
+}
+
+void ABaseDungeonInstance::SpawnCornerPillars()
+{
+	TArray<uint64> PillarKeys;
+	PillarKeys.Reserve(Layout->ViewCornerPillarPositions().Num());
+	for (const FGridCorner& Corner : Layout->ViewCornerPillarPositions())
+	{
+		PillarKeys.Add(GetCornerKey(Corner));
+	}
+	PillarMeshISM->SetStaticMesh(PillarMesh);
+	SubmitInstances(EDungeonMeshCategory::Pillar, PillarKeys);
+}
+
+FTransform ABaseDungeonInstance::MakeInstanceTransform(const EDungeonMeshCategory Category, const uint64 Key) const
+{
+	switch (Category)
+	{
+	case EDungeonMeshCategory::RoomFloor:
+		{
+			// Orientations are hashed from the dungeon's seed and the tile rather than drawn in order, so the same seed always looks the same and a tile
+			// that survives an incremental respawn with the same seed keeps its orientation
+			const FGridCoordinate Coordinate = FGridCoordinate::FromPackedKey(Key);
+			const FRotator Rotation = bUseRandomFloorOrientation ? FRotator(0.0f, 90 * (HashCombineFast(static_cast<uint32>(Seed), GetTypeHash(Coordinate)) & 3), 0.0f) : FRotator::ZeroRotator;
+			return FTransform(Rotation, GetPositionForCoordinate(Coordinate), FVector(1.0f, 1.0f, 1.0f));
+		}
+	case EDungeonMeshCategory::CorridorFloor:
+		return FTransform(FRotator::ZeroRotator, GetPositionForCoordinate(FGridCoordinate::FromPackedKey(Key)), FVector(1.0f, 1.0f, 1.0f));
+	case EDungeonMeshCategory::Wall:
+	case EDungeonMeshCategory::Door:
+		{
+			const FGridEdge Edge = GetEdgeFromKey(Key);
+			return FTransform(GetRotationForEdge(Edge), GetPositionForEdge(Edge), FVector(1.0f, 1.0f, 1.0f));
+		}
+	case EDungeonMeshCategory::Pillar:
+		return FTransform(FRotator::ZeroRotator, GetPositionForCorner(GetCornerFromKey(Key)), FVector(1.0f, 1.0f, 1.0f));
+	default:
+		checkNoEntry();
+		return FTransform::Identity;
+	}
+}
+
+void ABaseDungeonInstance::PrepareForRespawn()
+{
+	// A layout still being generated in the background would otherwise replace the one about to be spawned when it finishes
+	CancelDungeonGeneration();
+
+	if (!bIncrementalRespawn)
+	{
+		ClearDungeon();
+		return;
+	}
+
+	// Instances from a time-sliced spawn are keyed as they are added, so a half-finished spawn can still be diffed against
+	CancelSpawning();
+	Layout = nullptr;
+}
+
+UInstancedStaticMeshComponent* ABaseDungeonInstance::GetCategoryComponent(const EDungeonMeshCategory Category) const
+{
+	switch (Category)
+	{
+	case EDungeonMeshCategory::RoomFloor: return RoomFloorMeshISM;
+	case EDungeonMeshCategory::CorridorFloor: return CorridorFloorMeshISM;
+	case EDungeonMeshCategory::Wall: return WallMeshISM;
+	case EDungeonMeshCategory::Door: return DoorMeshISM;
+	case EDungeonMeshCategory::Pillar: return PillarMeshISM;
+	default: checkNoEntry(); return nullptr;
+	}
+}
+
+void ABaseDungeonInstance::SubmitInstances(const EDungeonMeshCategory Category, const TArray<uint64>& Keys)
+{
+	// No keys track the category's own component while split into cells, so any instances it was loaded with are cleared
+	UInstancedStaticMeshComponent* CategoryComponent = GetCategoryComponent(Category);
+	if (SpawnedCellSize > 0 && CategoryComponent->GetInstanceCount() > 0)
+	{
+		CategoryComponent->ClearInstances();
+	}
+
+	if (bStreamingCells)
+	{
+		for (const uint64 Key : Keys)
+		{
+			StreamingCells.FindOrAdd(GetCellKey(Category, Key)).Keys[static_cast<int32>(Category)].Add(Key);
+		}
+		return;
+	}
+
+	TMap<uint64, TArray<uint64>> InstancesByCell;
+	if (SpawnedCellSize <= 0)
+	{
+		// The single bucket is submitted even when the category is empty, so the instances from before are released
+		InstancesByCell.Add(FGridCoordinate(0, 0).GetPackedKey());
+	}
+	for (const uint64 Key : Keys)
+	{
+		InstancesByCell.FindOrAdd(GetCellKey(Category, Key)).Add(Key);
+	}
+
+	// Cells with nothing left in them are released whole
+	for (TMap<uint64, FInstanceBucket>::TIterator It = SpawnedBuckets[static_cast<int32>(Category)].CreateIterator(); It; ++It)
+	{
+		if (!InstancesByCell.Contains(It.Key()))
+		{
+			ReleaseBucket(It.Value());
+			It.RemoveCurrent();
+		}
+	}
+
+	for (const TPair<uint64, TArray<uint64>>& Pair : InstancesByCell)
+	{
+		SubmitCellInstances(Category, Pair.Key, Pair.Value);
+	}
+}
+
+void ABaseDungeonInstance::SubmitCellInstances(const EDungeonMeshCategory Category, const uint64 CellKey, const TArray<uint64>& Keys)
+{
+	if (Keys.Num() == 0)
+	{
+		// Nothing of the category is left in the cell, so its bucket is released rather than left holding the previous instances.
+		// Without cells there may be no bucket yet, while the category's component still holds instances loaded with the level.
+		if (FInstanceBucket* Bucket = SpawnedBuckets[static_cast<int32>(Category)].Find(CellKey))
+		{
+			ReleaseBucket(*Bucket);
+			SpawnedBuckets[static_cast<int32>(Category)].Remove(CellKey);
+		}
+		else if (SpawnedCellSize <= 0)
+		{
+			GetCategoryComponent(Category)->ClearInstances();
+		}
+		return;
+	}
+
+	TArray<FTransform> Transforms;
+	Transforms.Reserve(Keys.Num());
+	for (const uint64 Key : Keys)
+	{
+		Transforms.Add(MakeInstanceTransform(Category, Key));
+	}
+
+	// Keys aren't saved but instances are, so a component loaded with a level can hold instances no key matches.
+	// Diffing needs a key for every instance, so a component that is out of step with its keys is cleared and spawned in full.
+	FInstanceBucket* Bucket = SpawnedBuckets[static_cast<int32>(Category)].Find(CellKey);
+	UInstancedStaticMeshComponent* Component = Bucket ? Bucket->Component : SpawnedCellSize <= 0 ? GetCategoryComponent(Category) : nullptr;
+	const int32 NumSpawnedKeys = Bucket ? Bucket->InstanceKeys.Num() : 0;
+	if (Component && Component->GetInstanceCount() != NumSpawnedKeys)
+	{
+		UE_LOG(LogTemp, Log, TEXT("%s has %d instances but %d keys, respawning it in full"), *Component->GetName(), Component->GetInstanceCount(), NumSpawnedKeys);
+		Component->ClearInstances();
+		if (Bucket)
+		{
+			Bucket->InstanceKeys.Reset();
+		}
+	}
+	if (!Bucket || Bucket->InstanceKeys.Num() == 0)
+	{
+		AddSpawnInstances(Category, CellKey, Keys, Transforms);
+		return;
+	}
+
+	// The category's mesh may have changed since the cell was spawned
+	Component->SetStaticMesh(GetCategoryComponent(Category)->GetStaticMesh());
+
+	TArray<uint64>& InstanceKeys = Bucket->InstanceKeys;
+	TMap<uint64, int32> SpawnedIndices;
+	SpawnedIndices.Reserve(InstanceKeys.Num());
+	for (int32 InstanceIndex = 0; InstanceIndex < InstanceKeys.Num(); InstanceIndex++)
+	{
+		SpawnedIndices.Add(InstanceKeys[InstanceIndex], InstanceIndex);
+	}
+
+	// Match the new instances up with the spawned ones by key
+	TBitArray<> bKeepInstance(false, InstanceKeys.Num());
+	TArray<TPair<int32, FTransform>> MovedInstances;
+	TArray<uint64> AddedKeys;
+	TArray<FTransform> AddedTransforms;
+	for (int32 Index = 0; Index < Keys.Num(); Index++)
+	{
+		const int32* SpawnedIndex = SpawnedIndices.Find(Keys[Index]);
+		if (!SpawnedIndex)
+		{
+			AddedKeys.Add(Keys[Index]);
+			AddedTransforms.Add(Transforms[Index]);
+			continue;
+		}
+
+		bKeepInstance[*SpawnedIndex] = true;
+		FTransform SpawnedTransform;
+		Component->GetInstanceTransform(*SpawnedIndex, SpawnedTransform, false);
+		if (!SpawnedTransform.Equals(Transforms[Index]))
+		{
+			MovedInstances.Emplace(*SpawnedIndex, Transforms[Index]);
+		}
+	}
+
+	// Moves go first, while the indices still match, as one batch update per contiguous run of instances
+	MovedInstances.Sort([](const TPair<int32, FTransform>& A, const TPair<int32, FTransform>& B) { return A.Key < B.Key; });
+	TArray<FTransform> RunTransforms;
+	for (int32 RunStart = 0; RunStart < MovedInstances.Num();)
+	{
+		int32 RunEnd = RunStart + 1;
+		while (RunEnd < MovedInstances.Num() && MovedInstances[RunEnd].Key == MovedInstances[RunEnd - 1].Key + 1)
+		{
+			RunEnd++;
+		}
+
+		RunTransforms.Reset();
+		for (int32 Index = RunStart; Index < RunEnd; Index++)
+		{
+			RunTransforms.Add(MovedInstances[Index].Value);
+		}
+		Component->BatchUpdateInstancesTransforms(MovedInstances[RunStart].Key, RunTransforms, false, false, true);
+		RunStart = RunEnd;
+	}
+
+	TArray<int32> RemovedIndices;
+	for (int32 InstanceIndex = 0; InstanceIndex < InstanceKeys.Num(); InstanceIndex++)
+	{
+		if (!bKeepInstance[InstanceIndex])
+		{
+			RemovedIndices.Add(InstanceIndex);
+		}
+	}
+	if (RemovedIndices.Num() > 0)
+	{
+		Component->RemoveInstances(RemovedIndices);
+
+		// The keys are removed the same way the component removes its instances: instanced components shift the later instances down,
+		// while hierarchical ones remove from the highest index first and move their last instance into each gap
+		if (Component->IsA<UHierarchicalInstancedStaticMeshComponent>())
+		{
+			for (int32 Index = RemovedIndices.Num() - 1; Index >= 0; Index--)
+			{
+				InstanceKeys.RemoveAtSwap(RemovedIndices[Index]);
+			}
+		}
+		else
+		{
+			int32 NumCompacted = 0;
+			for (int32 InstanceIndex = 0; InstanceIndex < InstanceKeys.Num(); InstanceIndex++)
+			{
+				if (bKeepInstance[InstanceIndex])
+				{
+					InstanceKeys[NumCompacted++] = InstanceKeys[InstanceIndex];
+				}
+			}
+			InstanceKeys.SetNum(NumCompacted);
+		}
+	}
+	if (MovedInstances.Num() > 0)
+	{
+		Component->MarkRenderStateDirty();
+	}
+
+	const int32 NumKept = InstanceKeys.Num();
+	AddSpawnInstances(Category, CellKey, AddedKeys, AddedTransforms);
+	UE_LOG(LogTemp, Verbose, TEXT("Respawned %s: kept %d, moved %d, removed %d, added %d instances"), *Component->GetName(), NumKept - MovedInstances.Num(), MovedInstances.Num(), RemovedIndices.Num(), AddedKeys.Num());
+}
+
+uint64 ABaseDungeonInstance::GetCellKey(const EDungeonMeshCategory Category, const uint64 Key) const
+{
+	if (SpawnedCellSize <= 0) return FGridCoordinate(0, 0).GetPackedKey();
+
+	// Tiles, edges and corners all lie on multiples of half a tile, so offsetting by a quarter of a tile keeps every one of them
+	// clear of the cell boundaries. Working in quarter tiles keeps it exact, and a tile lands in the same cell as GetCellForCoordinate gives.
+	const FGridCoordinate Sum = FGridCoordinate::FromPackedKey(Key);
+	const int32 QuartersPerSum = 4 / GetTilesPerKey(Category);
+	return FGridCoordinate(FloorDivide(Sum.X * QuartersPerSum + 1, 4 * SpawnedCellSize), FloorDivide(Sum.Y * QuartersPerSum + 1, 4 * SpawnedCellSize)).GetPackedKey();
+}
+
+ABaseDungeonInstance::FInstanceBucket& ABaseDungeonInstance::FindOrAddBucket(const EDungeonMeshCategory Category, const uint64 CellKey)
+{
+	FInstanceBucket& Bucket = SpawnedBuckets[static_cast<int32>(Category)].FindOrAdd(CellKey);
+	if (Bucket.Component) return Bucket;
+
+	UInstancedStaticMeshComponent* CategoryComponent = GetCategoryComponent(Category);
+	if (SpawnedCellSize <= 0)
+	{
+		Bucket.Component = CategoryComponent;
+		return Bucket;
+	}
+
+	// Each cell gets its own hierarchical component, set up like the category's component, so it has its own bounds and cluster tree
+	// Cell components are respawned from the layout rather than saved with the level, since no keys would be saved to diff them against
+	UHierarchicalInstancedStaticMeshComponent* CellComponent = NewObject<UHierarchicalInstancedStaticMeshComponent>(this, NAME_None, RF_Transient);
+	CellComponent->SetupAttachment(RootComponent);
+	CellComponent->SetStaticMesh(CategoryComponent->GetStaticMesh());
+	CellComponent->SetCollisionProfileName(CategoryComponent->GetCollisionProfileName());
+	CellComponent->SetCastShadow(CategoryComponent->CastShadow);
+	CellComponent->RegisterComponent();
+	if (DisabledCellKeys.Contains(CellKey))
+	{
+		ApplyCellEnabled(CellComponent, Category, false);
+	}
+	CellComponents.Add(CellComponent);
+	Bucket.Component = CellComponent;
+	return Bucket;
+}
+
+void ABaseDungeonInstance::ReleaseBucket(FInstanceBucket& Bucket)
+{
+	if (!Bucket.Component) return;
+	if (UHierarchicalInstancedStaticMeshComponent* CellComponent = Cast<UHierarchicalInstancedStaticMeshComponent>(Bucket.Component))
+	{
+		CellComponents.RemoveSingleSwap(CellComponent);
+		CellComponent->DestroyComponent();
+	}
+	else
+	{
+		Bucket.Component->ClearInstances();
+	}
+	Bucket.Component = nullptr;
+	Bucket.InstanceKeys.Reset();
+}
+
+void ABaseDungeonInstance::ReleaseAllBuckets()
+{
+	LoadedCellKeys.Reset();
+	for (TMap<uint64, FInstanceBucket>& Buckets : SpawnedBuckets)
+	{
+		for (TPair<uint64, FInstanceBucket>& Pair : Buckets)
+		{
+			ReleaseBucket(Pair.Value);
+		}
+		Buckets.Reset();
+	}
+}
+
+void ABaseDungeonInstance::ApplyCellEnabled(UInstancedStaticMeshComponent* Component, const EDungeonMeshCategory Category, const bool bEnabled) const
+{
+	Component->SetVisibility(bEnabled);
+	Component->SetCollisionEnabled(bEnabled ? GetCategoryComponent(Category)->GetCollisionEnabled() : ECollisionEnabled::NoCollision);
+}
+
+void ABaseDungeonInstance::UpdateStreaming(const TArray<FVector>& ViewerLocations)
+{
+	if (!bStreamingCells) return;
+	LastViewerLocations = ViewerLocations;
+
+	// Loaded cells stay loaded out to the unload radius, so a player on the edge of the load radius doesn't load and unload a cell every update
+	const double CellWorldSize = GridSize * SpawnedCellSize;
+	const double LoadRadius = FMath::Max(StreamingLoadRadius, 0.0f);
+	const double UnloadRadius = FMath::Max(StreamingUnloadRadius, StreamingLoadRadius);
+
+	// Cells are laid out relative to the dungeon, like the instances in them
+	const TArray<FVector> LocalViewerLocations = GetLocalViewerLocations(ViewerLocations);
+
+	// Only the cells within the unload radius of a player and the loaded cells can be wanted, so the work doesn't grow with the dungeon
+	TSet<uint64> CandidateCellKeys = LoadedCellKeys;
+	const int32 RadiusInCells = FMath::CeilToInt(UnloadRadius / CellWorldSize) + 1;
+	if (FMath::Square(2.0 * RadiusInCells + 1.0) * LocalViewerLocations.Num() > StreamingCells.Num())
+	{
+		// The players are near most of the dungeon anyway, so checking every cell is cheaper than searching around each player
+		for (const TPair<uint64, FStreamingCell>& Pair : StreamingCells)
+		{
+			CandidateCellKeys.Add(Pair.Key);
+		}
+	}
+	else
+	{
+		for (const FVector& ViewerLocation : LocalViewerLocations)
+		{
+			const FVector CellLocation = ViewerLocation / CellWorldSize;
+			const int32 ViewerCellX = FMath::FloorToInt(CellLocation.X);
+			const int32 ViewerCellY = FMath::FloorToInt(CellLocation.Y);
+			for (int32 CellY = ViewerCellY - RadiusInCells; CellY <= ViewerCellY + RadiusInCells; CellY++)
+			{
+				for (int32 CellX = ViewerCellX - RadiusInCells; CellX <= ViewerCellX + RadiusInCells; CellX++)
+				{
+					const uint64 CellKey = FGridCoordinate(CellX, CellY).GetPackedKey();
+					if (StreamingCells.Contains(CellKey))
+					{
+						CandidateCellKeys.Add(CellKey);
+					}
+				}
+			}
+		}
+	}
+
+	TArray<TPair<double, uint64>> WantedCells;
+	for (const uint64 CellKey : CandidateCellKeys)
+	{
+		if (!StreamingCells.Contains(CellKey)) continue;
+		const double Radius = LoadedCellKeys.Contains(CellKey) ? UnloadRadius : LoadRadius;
+		const double DistanceSquared = GetCellDistanceSquared(CellKey, LocalViewerLocations);
+		if (DistanceSquared <= Radius * Radius)
+		{
+			WantedCells.Emplace(DistanceSquared, CellKey);
+		}
+	}
+
+	// Keep the nearest cells if there are more than the cap
+	if (MaxLoadedCells > 0 && WantedCells.Num() > MaxLoadedCells)
+	{
+		WantedCells.Sort([](const TPair<double, uint64>& A, const TPair<double, uint64>& B) { return A.Key < B.Key; });
+		WantedCells.SetNum(MaxLoadedCells);
+	}
+
+	TSet<uint64> WantedCellKeys;
+	WantedCellKeys.Reserve(WantedCells.Num());
+	int32 NumLoaded = 0;
+	for (const TPair<double, uint64>& WantedCell : WantedCells)
+	{
+		WantedCellKeys.Add(WantedCell.Value);
+		const bool bWasLoaded = LoadedCellKeys.Contains(WantedCell.Value);
+		if (!bWasLoaded || bResubmitLoadedCells)
+		{
+			LoadStreamingCell(WantedCell.Value, StreamingCells[WantedCell.Value]);
+		}
+		if (!bWasLoaded)
+		{
+			NumLoaded++;
+		}
+	}
+	const int32 NumUnloaded = LoadedCellKeys.Difference(WantedCellKeys).Num();
+
+	// Release every other bucket, including any left over from a previous layout
+	int32 NumInstances = 0;
+	for (TMap<uint64, FInstanceBucket>& Buckets : SpawnedBuckets)
+	{
+		for (TMap<uint64, FInstanceBucket>::TIterator It = Buckets.CreateIterator(); It; ++It)
+		{
+			if (!WantedCellKeys.Contains(It.Key()))
+			{
+				ReleaseBucket(It.Value());
+				It.RemoveCurrent();
+				continue;
+			}
+			NumInstances += It.Value().InstanceKeys.Num();
+		}
+	}
+	LoadedCellKeys = MoveTemp(WantedCellKeys);
+	bResubmitLoadedCells = false;
+
+	if (NumLoaded > 0 || NumUnloaded > 0)
+	{
+		UE_LOG(LogTemp, Log, TEXT("Streamed in %d and out %d cells, %d of %d cells now loaded with %d instances"), NumLoaded, NumUnloaded, LoadedCellKeys.Num(), StreamingCells.Num(), NumInstances);
+	}
+}
+
+bool ABaseDungeonInstance::IsStreamingDungeon() const
+{
+	return bStreamingCells;
+}
+
+bool ABaseDungeonInstance::IsCellLoaded(const FGridCoordinate& Cell) const
+{
+	if (bStreamingCells)
+	{
+		return LoadedCellKeys.Contains(Cell.GetPackedKey());
+	}
+
+	for (const TMap<uint64, FInstanceBucket>& Buckets : SpawnedBuckets)
+	{
+		if (Buckets.Contains(Cell.GetPackedKey())) return true;
+	}
+	return false;
+}
+
+int32 ABaseDungeonInstance::GetNumLoadedCells() const
+{
+	return LoadedCellKeys.Num();
+}
+
+void ABaseDungeonInstance::LoadStreamingCell(const uint64 CellKey, const FStreamingCell& Cell)
+{
+	for (int32 CategoryIndex = 0; CategoryIndex < static_cast<int32>(EDungeonMeshCategory::Num); CategoryIndex++)
+	{
+		SubmitCellInstances(static_cast<EDungeonMeshCategory>(CategoryIndex), CellKey, Cell.Keys[CategoryIndex]);
+	}
+}
+
+double ABaseDungeonInstance::GetCellDistanceSquared(const uint64 CellKey, const TArray<FVector>& LocalViewerLocations) const
+{
+	// A cell reaches from half a tile before the centre of its first tile to half a tile after the centre of its last
+	const FGridCoordinate Cell = FGridCoordinate::FromPackedKey(CellKey);
+	const double CellWorldSize = GridSize * SpawnedCellSize;
+	const FVector2D CellMin(Cell.X * CellWorldSize - GridSize * 0.5, Cell.Y * CellWorldSize - GridSize * 0.5);
+	const FBox2D CellBox(CellMin, CellMin + FVector2D(CellWorldSize, CellWorldSize));
+
+	double DistanceSquared = TNumericLimits<double>::Max();
+	for (const FVector& ViewerLocation : LocalViewerLocations)
+	{
+		DistanceSquared = FMath::Min(DistanceSquared, static_cast<double>(CellBox.ComputeSquaredDistanceToPoint(FVector2D(ViewerLocation))));
+	}
+	return DistanceSquared;
+}
+
+FVector ABaseDungeonInstance::GetPositionForCoordinate(const FGridCoordinate& Coordinate) const
+{
+	return UGridCoordinateHelperLibrary::GetWorldPositionFromGridCoordinate(Coordinate, GridSize);
+}
+
+FVector ABaseDungeonInstance::GetPositionForCorner(const FGridCorner& Corner) const
+{
+	return (UGridCoordinateHelperLibrary::GetWorldPositionFromGridCoordinate(Corner.CoordinateA, GridSize) + UGridCoordinateHelperLibrary::GetWorldPositionFromGridCoordinate(Corner.CoordinateB, GridSize) + UGridCoordinateHelperLibrary::GetWorldPositionFromGridCoordinate(Corner.CoordinateC, GridSize) + UGridCoordinateHelperLibrary::GetWorldPositionFromGridCoordinate(Corner.CoordinateD, GridSize)) / 4.0f;
+}
+
+FVector ABaseDungeonInstance::GetPositionForEdge(const FGridEdge& Edge) const
+{
+	return (UGridCoordinateHelperLibrary::GetWorldPositionFromGridCoordinate(Edge.CoordinateA, GridSize) + UGridCoordinateHelperLibrary::GetWorldPositionFromGridCoordinate(Edge.CoordinateB, GridSize)) / 2.0f;
+}
+
+FRotator ABaseDungeonInstance::GetRotationForEdge(const FGridEdge& Edge) const
+{
+	return (GetPositionForCoordinate(Edge.CoordinateB) - GetPositionForCoordinate(Edge.CoordinateA)).Rotation();
+}
\ No newline at end of file
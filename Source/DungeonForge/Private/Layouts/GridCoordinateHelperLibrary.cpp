@@ -55,7 +55,7 @@ FGridEdge::FGridEdge(const FGridCoordinate& InCoordinateA, const FGridCoordinate
 
 void FGridEdge::Sort()
 {
-	if (GetTypeHash(CoordinateA) < GetTypeHash(CoordinateB)) { return; }
+	if (CoordinateA.GetPackedKey() <= CoordinateB.GetPackedKey()) { return; }
 
 	// swap coordinates
 	const FGridCoordinate Temp = CoordinateA;
@@ -65,15 +65,14 @@ void FGridEdge::Sort()
 
 bool FGridEdge::SharesSingleCoordinate(const FGridEdge EdgeB, FGridCoordinate& OutSharedCoordinate) const
 {
-	const TSet<FGridCoordinate> EdgeACoords = { CoordinateA, CoordinateB };
-	const TSet<FGridCoordinate> EdgeBCoords = { EdgeB.CoordinateA, EdgeB.CoordinateB };
-	TSet<FGridCoordinate> SharedCoords = EdgeACoords.Intersect(EdgeBCoords);
-	if (SharedCoords.Num() == 1)
+	const bool bSharesA = CoordinateA == EdgeB.CoordinateA || CoordinateA == EdgeB.CoordinateB;
+	const bool bSharesB = CoordinateB != CoordinateA && (CoordinateB == EdgeB.CoordinateA || CoordinateB == EdgeB.CoordinateB);
+	if (bSharesA == bSharesB)
 	{
-		OutSharedCoordinate = SharedCoords.Array()[0];
-		return true;
+		return false;
 	}
-	return false;
+	OutSharedCoordinate = bSharesA ? CoordinateA : CoordinateB;
+	return true;
 }
 
 bool FGridEdge::FormsCorner(FGridEdge EdgeB) const
@@ -81,15 +80,11 @@ bool FGridEdge::FormsCorner(FGridEdge EdgeB) const
 	FGridCoordinate OutSharedCoordinate;
 	if (!SharesSingleCoordinate(EdgeB, OutSharedCoordinate)) return false;
 
-	TSet<FGridCoordinate> AllCoords = { CoordinateA, CoordinateB, EdgeB.CoordinateA, EdgeB.CoordinateB }; // This should only be 3 coordinates as one is duplicated
-	AllCoords.Remove(OutSharedCoordinate); // Remove the duplicated coord
+	// The edges form a corner if the two coordinates which aren't shared are diagonal from eachother.
+	const FGridCoordinate OtherA = CoordinateA == OutSharedCoordinate ? CoordinateB : CoordinateA;
+	const FGridCoordinate OtherB = EdgeB.CoordinateA == OutSharedCoordinate ? EdgeB.CoordinateB : EdgeB.CoordinateA;
 
-	// The edges form a corner if these remaining coordinates are diagonal from eachother.
-	const TArray<FGridCoordinate> PossibleCorners = AllCoords.Array();
-	const FGridCoordinate A = PossibleCorners[0];
-	const TSet<FGridCoordinate> ADiagonals = TSet(UGridCoordinateHelperLibrary::GetAdjacentCoordinates(A, true, 0)).Difference(TSet(UGridCoordinateHelperLibrary::GetAdjacentCoordinates(A, false, 0)));
-
-	return ADiagonals.Contains(PossibleCorners[1]);
+	return FMath::Abs(OtherA.X - OtherB.X) == 1 && FMath::Abs(OtherA.Y - OtherB.Y) == 1;
 }
 
 FGridCorner::FGridCorner()
@@ -108,12 +103,10 @@ FGridCorner::FGridCorner(const FGridCoordinate& InCoordinateA, const FGridCoordi
 
 void FGridCorner::Sort()
 {
-	TArray<FGridCoordinate> Corners = { CoordinateA, CoordinateB, CoordinateC, CoordinateD };
+	TArray<FGridCoordinate, TInlineAllocator<4>> Corners = { CoordinateA, CoordinateB, CoordinateC, CoordinateD };
 
-	Corners.Sort([](const FGridCoordinate& A, const FGridCoordinate& B)
-	{
-		return GetTypeHash(A) < GetTypeHash(B);
-	});
+	// Order by packed key rather than hash, so sorting does not need to hash at all
+	Corners.Sort();
 
 	CoordinateA = Corners[0];
 	CoordinateB = Corners[1];
@@ -129,48 +122,63 @@ FGridCorner FGridCorner::FromEdges(const FGridEdge& EdgeA, const FGridEdge& Edge
 		return FGridCorner();
 	}
 	
-	TSet<FGridCoordinate> OtherCoords = { EdgeA.CoordinateA, EdgeA.CoordinateB, EdgeB.CoordinateA, EdgeB.CoordinateB };
-	// At this point OtherCoords should be a list of 3 coordinates since one of the edge coordinates is shared.
+	FGridCoordinate SharedCoord;
+	EdgeA.SharesSingleCoordinate(EdgeB, SharedCoord);
+	const FGridCoordinate OtherA = EdgeA.CoordinateA == SharedCoord ? EdgeA.CoordinateB : EdgeA.CoordinateA;
+	const FGridCoordinate OtherB = EdgeB.CoordinateA == SharedCoord ? EdgeB.CoordinateB : EdgeB.CoordinateA;
+
+	// The fourth coordinate completes the 2x2 square, diagonally opposite the shared coordinate
+	const FGridCoordinate OppositeCoord(OtherA.X + OtherB.X - SharedCoord.X, OtherA.Y + OtherB.Y - SharedCoord.Y);
+	return FGridCorner(SharedCoord, OtherA, OppositeCoord, OtherB);
+}
+
+FGridCorner FGridCorner::FromVertex(const FGridCoordinate& BottomLeftTile)
+{
+	return FGridCorner(
+		BottomLeftTile,
+		FGridCoordinate(BottomLeftTile.X + 1, BottomLeftTile.Y),
+		FGridCoordinate(BottomLeftTile.X + 1, BottomLeftTile.Y + 1),
+		FGridCoordinate(BottomLeftTile.X, BottomLeftTile.Y + 1));
+}
+
+FRectBox::FRectBox()
+{
+}
 
-	TSet<FGridCoordinate> AdjacentCoords;
+FRectBox::FRectBox(const FGridCoordinate InBoxOrigin, const FGridCoordinate InBoxBound)
+{
+	BoxOrigin = InBoxOrigin;
+	BoxBound = InBoxBound;
+}
 
-	for (const FGridCoordinate OtherCoord : OtherCoords)
+int32 FRectBox::GetVolume() const
+{
+	return (BoxBound.X - BoxOrigin.X + 1) * (BoxBound.Y - BoxOrigin.Y + 1);
+}
+
+TArray<FGridCoordinate> FRectBox::GetFillCoordinates() const
+{
+	TArray<FGridCoordinate> ReturnCoordinates;
+
+	for (int32 X = BoxOrigin.X; X <= BoxBound.X; X++)
 	{
-		for (const auto AdjacentCoord : UGridCoordinateHelperLibrary::GetAdjacentCoordinates(OtherCoord))
+		for (int32 Y = BoxOrigin.Y; Y <= BoxBound.Y; Y++)
 		{
-			if (AdjacentCoords.Contains(AdjacentCoord) && !OtherCoords.Contains(AdjacentCoord))
-			{
-				OtherCoords.Add(AdjacentCoord);
-				return FGridCorner(OtherCoords.Array()[0], OtherCoords.Array()[1], OtherCoords.Array()[2], OtherCoords.Array()[3]);
-			};
-			AdjacentCoords.Add(AdjacentCoord);
+			ReturnCoordinates.Add(FGridCoordinate(X, Y));
 		}
 	}
 
-	// Shouldn't get to this point
-	UE_LOG(LogTemp, Error, TEXT("FGridCorner::FromEdges"));
-	return FGridCorner();
+	return ReturnCoordinates;
 }
 
 TArray<FGridCoordinate> UGridCoordinateHelperLibrary::GetAdjacentCoordinates(const FGridCoordinate& Coordinate, const bool bIncludeDiagonal, const int32 Direction)
 {
 	TArray<FGridCoordinate> AdjacentCoordinates;
-
-	// Add orthogonal coordinates
-	if (Direction == 0 || Direction == 2) AdjacentCoordinates.Add(FGridCoordinate(Coordinate.X + 1, Coordinate.Y));
-	if (Direction == 0 || Direction == 4) AdjacentCoordinates.Add(FGridCoordinate(Coordinate.X - 1, Coordinate.Y));
-	if (Direction == 0 || Direction == 1) AdjacentCoordinates.Add(FGridCoordinate(Coordinate.X, Coordinate.Y + 1));
-	if (Direction == 0 || Direction == 3) AdjacentCoordinates.Add(FGridCoordinate(Coordinate.X, Coordinate.Y - 1));
-
-	if (bIncludeDiagonal && Direction == 0)
+	AdjacentCoordinates.Reserve(NumDirections);
+	ForEachAdjacentCoordinate(Coordinate, [&AdjacentCoordinates](const FGridCoordinate& AdjacentCoordinate)
 	{
-		// Add diagonal coordinates
-		AdjacentCoordinates.Add(FGridCoordinate(Coordinate.X + 1, Coordinate.Y + 1));
-		AdjacentCoordinates.Add(FGridCoordinate(Coordinate.X + 1, Coordinate.Y - 1));
-		AdjacentCoordinates.Add(FGridCoordinate(Coordinate.X - 1, Coordinate.Y + 1));
-		AdjacentCoordinates.Add(FGridCoordinate(Coordinate.X - 1, Coordinate.Y - 1));
-	}
-
+		AdjacentCoordinates.Add(AdjacentCoordinate);
+	}, bIncludeDiagonal, Direction);
 	return AdjacentCoordinates;
 }
 
@@ -188,7 +196,10 @@ TArray<FGridCoordinate> UGridCoordinateHelperLibrary::Expand(TArray<FGridCoordin
 	{
 		for (FGridCoordinate Coordinate : RoomRepresentation)
 		{
-			RoomRepresentationSet.Append(GetAdjacentCoordinates(Coordinate, bIncludeDiagonal, Direction));
+			ForEachAdjacentCoordinate(Coordinate, [&RoomRepresentationSet](const FGridCoordinate& AdjacentCoordinate)
+			{
+				RoomRepresentationSet.Add(AdjacentCoordinate);
+			}, bIncludeDiagonal, Direction);
 		}
 		RoomRepresentation = RoomRepresentationSet.Array();
 	}
@@ -0,0 +1,67 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Layouts/GridRectSet.h"
+
+void FGridRectSet::Add(const FRectBox& Rect)
+{
+	const int32 RectIndex = Rects.Add(Rect);
+	NumTiles += Rect.GetVolume();
+
+	for (int32 ChunkY = Rect.BoxOrigin.Y >> ChunkShift; ChunkY <= Rect.BoxBound.Y >> ChunkShift; ChunkY++)
+	{
+		for (int32 ChunkX = Rect.BoxOrigin.X >> ChunkShift; ChunkX <= Rect.BoxBound.X >> ChunkShift; ChunkX++)
+		{
+			ChunkRects.FindOrAdd(FGridCoordinate(ChunkX, ChunkY).GetPackedKey()).Add(RectIndex);
+		}
+	}
+}
+
+void FGridRectSet::Append(const TConstArrayView<FRectBox> InRects)
+{
+	Rects.Reserve(Rects.Num() + InRects.Num());
+	for (const FRectBox& Rect : InRects)
+	{
+		Add(Rect);
+	}
+}
+
+bool FGridRectSet::Contains(const FGridCoordinate& Coordinate) const
+{
+	return FindRect(Coordinate) != nullptr;
+}
+
+const FRectBox* FGridRectSet::FindRect(const FGridCoordinate& Coordinate) const
+{
+	const TArray<int32>* RectIndices = ChunkRects.Find(FGridCoordinate(Coordinate.X >> ChunkShift, Coordinate.Y >> ChunkShift).GetPackedKey());
+	if (!RectIndices)
+	{
+		return nullptr;
+	}
+
+	for (const int32 RectIndex : *RectIndices)
+	{
+		if (Rects[RectIndex].Contains(Coordinate))
+		{
+			return &Rects[RectIndex];
+		}
+	}
+	return nullptr;
+}
+
+void FGridRectSet::Reset()
+{
+	Rects.Reset();
+	ChunkRects.Reset();
+	NumTiles = 0;
+}
+
+SIZE_T FGridRectSet::GetAllocatedSize() const
+{
+	SIZE_T AllocatedSize = Rects.GetAllocatedSize() + ChunkRects.GetAllocatedSize();
+	for (const TPair<uint64, TArray<int32>>& Pair : ChunkRects)
+	{
+		AllocatedSize += Pair.Value.GetAllocatedSize();
+	}
+	return AllocatedSize;
+}
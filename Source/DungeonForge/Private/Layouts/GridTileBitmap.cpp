@@ -0,0 +1,205 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Layouts/GridTileBitmap.h"
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS && PLATFORM_CPU_X86_FAMILY
+#include <emmintrin.h>
+#define DUNGEONFORGE_BITMAP_SSE2 1
+#else
+#define DUNGEONFORGE_BITMAP_SSE2 0
+#endif
+
+namespace
+{
+	const FGridTileBitmap::FChunk EmptyChunk;
+}
+
+bool FGridTileBitmap::Add(const FGridCoordinate& Coordinate)
+{
+	FChunk& Chunk = Chunks.FindOrAdd(GetChunkKey(Coordinate.X >> ChunkShift, Coordinate.Y >> ChunkShift));
+	uint64& Row = Chunk.Rows[Coordinate.Y & ChunkMask];
+	const uint64 Bit = 1ull << (Coordinate.X & ChunkMask);
+	if (Row & Bit)
+	{
+		return false;
+	}
+	Row |= Bit;
+	NumTiles++;
+	return true;
+}
+
+void FGridTileBitmap::Append(const TConstArrayView<FGridCoordinate> Coordinates)
+{
+	for (const FGridCoordinate& Coordinate : Coordinates)
+	{
+		Add(Coordinate);
+	}
+}
+
+bool FGridTileBitmap::Contains(const FGridCoordinate& Coordinate) const
+{
+	const FChunk* Chunk = FindChunk(Coordinate.X >> ChunkShift, Coordinate.Y >> ChunkShift);
+	return Chunk && (Chunk->Rows[Coordinate.Y & ChunkMask] & (1ull << (Coordinate.X & ChunkMask))) != 0;
+}
+
+uint64 FGridTileBitmap::GetRowBits(const int32 X, const int32 Y) const
+{
+	const int32 ChunkX = X >> ChunkShift;
+	const int32 ChunkY = Y >> ChunkShift;
+	const int32 BitShift = X & ChunkMask;
+
+	const FChunk* Chunk = FindChunk(ChunkX, ChunkY);
+	uint64 Bits = Chunk ? Chunk->Rows[Y & ChunkMask] >> BitShift : 0;
+	if (BitShift != 0)
+	{
+		const FChunk* RightChunk = FindChunk(ChunkX + 1, ChunkY);
+		Bits |= RightChunk ? RightChunk->Rows[Y & ChunkMask] << (ChunkSize - BitShift) : 0;
+	}
+	return Bits;
+}
+
+bool FGridTileBitmap::IntersectsRows(const TConstArrayView<uint64> RowMasks, const FGridCoordinate& BottomLeft) const
+{
+	for (int32 Row = 0; Row < RowMasks.Num(); Row++)
+	{
+		if (GetRowBits(BottomLeft.X, BottomLeft.Y + Row) & RowMasks[Row])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void FGridTileBitmap::Union(const FGridTileBitmap& Other)
+{
+	for (const TPair<uint64, FChunk>& Pair : Other.Chunks)
+	{
+		FChunk& Chunk = Chunks.FindOrAdd(Pair.Key);
+		for (int32 LocalY = 0; LocalY < ChunkSize; LocalY++)
+		{
+			const uint64 Added = Pair.Value.Rows[LocalY] & ~Chunk.Rows[LocalY];
+			Chunk.Rows[LocalY] |= Added;
+			NumTiles += FMath::CountBits(Added);
+		}
+	}
+}
+
+void FGridTileBitmap::UnionTranslated(const FGridTileBitmap& Other, const FGridCoordinate& Offset)
+{
+	check(&Other != this);
+	for (const TPair<uint64, FChunk>& Pair : Other.Chunks)
+	{
+		const FGridCoordinate ChunkOrigin = GetChunkOrigin(Pair.Key);
+		const int32 TargetX = ChunkOrigin.X + Offset.X;
+		const int32 TargetChunkX = TargetX >> ChunkShift;
+		const int32 BitShift = TargetX & ChunkMask;
+		for (int32 LocalY = 0; LocalY < ChunkSize; LocalY++)
+		{
+			const uint64 Row = Pair.Value.Rows[LocalY];
+			if (Row == 0) continue;
+
+			// The row straddles two destination chunks unless it lands exactly on a chunk boundary
+			const int32 TargetY = ChunkOrigin.Y + LocalY + Offset.Y;
+			OrRowBits(TargetChunkX, TargetY, Row << BitShift);
+			if (BitShift != 0)
+			{
+				OrRowBits(TargetChunkX + 1, TargetY, Row >> (ChunkSize - BitShift));
+			}
+		}
+	}
+}
+
+void FGridTileBitmap::Difference(const FGridTileBitmap& Other)
+{
+	for (TPair<uint64, FChunk>& Pair : Chunks)
+	{
+		const FChunk* OtherChunk = Other.Chunks.Find(Pair.Key);
+		if (!OtherChunk) continue;
+		for (int32 LocalY = 0; LocalY < ChunkSize; LocalY++)
+		{
+			const uint64 Removed = Pair.Value.Rows[LocalY] & OtherChunk->Rows[LocalY];
+			Pair.Value.Rows[LocalY] &= ~Removed;
+			NumTiles -= FMath::CountBits(Removed);
+		}
+	}
+}
+
+void FGridTileBitmap::OrRowBits(const int32 ChunkX, const int32 Y, const uint64 Bits)
+{
+	if (Bits == 0) return;
+	uint64& Row = Chunks.FindOrAdd(GetChunkKey(ChunkX, Y >> ChunkShift)).Rows[Y & ChunkMask];
+	NumTiles += FMath::CountBits(Bits & ~Row);
+	Row |= Bits;
+}
+
+void FGridTileBitmap::Reset()
+{
+	Chunks.Reset();
+	NumTiles = 0;
+}
+
+TArray<FGridCoordinate> FGridTileBitmap::Array() const
+{
+	TArray<FGridCoordinate> OutArray;
+	OutArray.Reserve(NumTiles);
+	ForEach([&OutArray](const FGridCoordinate& Coordinate)
+	{
+		OutArray.Add(Coordinate);
+	});
+	return OutArray;
+}
+
+const FGridTileBitmap::FChunk& FGridTileBitmap::FindChunkOrEmpty(const int32 ChunkX, const int32 ChunkY) const
+{
+	const FChunk* Chunk = FindChunk(ChunkX, ChunkY);
+	return Chunk ? *Chunk : EmptyChunk;
+}
+
+void FGridTileBitmap::ComputeBoundaryMasks(const uint64 ChunkKey, const FChunk& Chunk, FBoundaryMasks& OutMasks) const
+{
+	const FGridCoordinate ChunkCoordinate = FGridCoordinate::FromPackedKey(ChunkKey);
+	const FChunk* BelowChunk = FindChunk(ChunkCoordinate.X, ChunkCoordinate.Y - 1);
+	const FChunk* AboveChunk = FindChunk(ChunkCoordinate.X, ChunkCoordinate.Y + 1);
+
+	const uint64* Rows = Chunk.Rows;
+	const uint64* LeftRows = FindChunkOrEmpty(ChunkCoordinate.X - 1, ChunkCoordinate.Y).Rows;
+	const uint64* RightRows = FindChunkOrEmpty(ChunkCoordinate.X + 1, ChunkCoordinate.Y).Rows;
+
+	// Pad the rows with the neighbouring chunks' edge rows so the row above and below can be read without branching
+	uint64 PaddedRows[ChunkSize + 2];
+	PaddedRows[0] = BelowChunk ? BelowChunk->Rows[ChunkSize - 1] : 0;
+	FMemory::Memcpy(&PaddedRows[1], Rows, sizeof(Chunk.Rows));
+	PaddedRows[ChunkSize + 1] = AboveChunk ? AboveChunk->Rows[0] : 0;
+
+	int32 LocalY = 0;
+#if DUNGEONFORGE_BITMAP_SSE2
+	// Two rows per iteration. A tile is on the east boundary if the tile one bit higher (or bit 0 of the chunk to the right) is empty.
+	for (; LocalY + 1 < ChunkSize; LocalY += 2)
+	{
+		const __m128i Row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Rows[LocalY]));
+		const __m128i FromRight = _mm_slli_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&RightRows[LocalY])), ChunkSize - 1);
+		const __m128i FromLeft = _mm_srli_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&LeftRows[LocalY])), ChunkSize - 1);
+		const __m128i Above = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&PaddedRows[LocalY + 2]));
+		const __m128i Below = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&PaddedRows[LocalY]));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&OutMasks.East[LocalY]), _mm_andnot_si128(_mm_or_si128(_mm_srli_epi64(Row, 1), FromRight), Row));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&OutMasks.West[LocalY]), _mm_andnot_si128(_mm_or_si128(_mm_slli_epi64(Row, 1), FromLeft), Row));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&OutMasks.North[LocalY]), _mm_andnot_si128(Above, Row));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&OutMasks.South[LocalY]), _mm_andnot_si128(Below, Row));
+	}
+#endif
+	for (; LocalY < ChunkSize; LocalY++)
+	{
+		const uint64 Row = Rows[LocalY];
+		OutMasks.East[LocalY] = Row & ~((Row >> 1) | (RightRows[LocalY] << (ChunkSize - 1)));
+		OutMasks.West[LocalY] = Row & ~((Row << 1) | (LeftRows[LocalY] >> (ChunkSize - 1)));
+		OutMasks.North[LocalY] = Row & ~PaddedRows[LocalY + 2];
+		OutMasks.South[LocalY] = Row & ~PaddedRows[LocalY];
+	}
+}
+
+SIZE_T FGridTileBitmap::GetAllocatedSize() const
+{
+	return Chunks.GetAllocatedSize();
+}
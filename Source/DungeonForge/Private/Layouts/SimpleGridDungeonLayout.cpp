@@ -3,101 +3,292 @@
 
 #include "Layouts/SimpleGridDungeonLayout.h"
 
+void FSimpleGridLayoutData::Reset()
+{
+	Seed = 0;
+	RoomTiles.Reset();
+	CorridorTiles.Reset();
+	RoomRects.Reset();
+	CorridorRects.Reset();
+	Walls.Reset();
+	Doors.Reset();
+	bImputesWallPositions = true;
+}
+
+USimpleGridDungeonLayout* FSimpleGridLayoutData::CreateLayout(UObject* Outer) const
+{
+	check(IsInGameThread());
+	USimpleGridDungeonLayout* Layout = NewObject<USimpleGridDungeonLayout>(Outer);
+	Layout->AddRoomTiles(RoomTiles);
+	Layout->AddCorridorTiles(CorridorTiles);
+	Layout->AddRoomRects(RoomRects);
+	Layout->AddCorridorRects(CorridorRects);
+	Layout->AddWalls(Walls);
+	Layout->AddDoors(Doors);
+	Layout->bImputesWallPositions = bImputesWallPositions;
+	return Layout;
+}
+
 USimpleGridDungeonLayout::USimpleGridDungeonLayout()
 {
 }
 
 TArray<FGridCoordinate> USimpleGridDungeonLayout::GetRoomTiles() const
 {
-	return RoomTiles.Array();
+	TArray<FGridCoordinate> OutTiles;
+	OutTiles.Reserve(RoomTiles.Num() + RoomRects.Num());
+	ForEachRoomTile([&OutTiles](const FGridCoordinate& Coordinate) { OutTiles.Add(Coordinate); });
+	return OutTiles;
 }
 
 TArray<FGridCoordinate> USimpleGridDungeonLayout::GetCorridorTiles() const
 {
-	return CorridorTiles.Array();
+	TArray<FGridCoordinate> OutTiles;
+	OutTiles.Reserve(CorridorTiles.Num() + CorridorRects.Num());
+	ForEachCorridorTile([&OutTiles](const FGridCoordinate& Coordinate) { OutTiles.Add(Coordinate); });
+	return OutTiles;
 }
 
 TArray<FGridCoordinate> USimpleGridDungeonLayout::GetAllFloorTiles() const
 {
-	TArray<FGridCoordinate> AllTiles = RoomTiles.Array();
-	AllTiles.Append(CorridorTiles.Array());
-	return AllTiles;
+	TArray<FGridCoordinate> OutTiles = GetCachedFloorTiles().Array();
+	OutTiles.Reserve(OutTiles.Num() + RoomRects.Num() + CorridorRects.Num());
+	RoomRects.ForEach([&OutTiles](const FGridCoordinate& Coordinate) { OutTiles.Add(Coordinate); });
+	CorridorRects.ForEach([&OutTiles](const FGridCoordinate& Coordinate) { OutTiles.Add(Coordinate); });
+	return OutTiles;
+}
+
+int32 USimpleGridDungeonLayout::GetNumFloorTiles() const
+{
+	return GetCachedFloorTiles().Num() + RoomRects.Num() + CorridorRects.Num();
+}
+
+bool USimpleGridDungeonLayout::IsRoomTile(const FGridCoordinate& Coordinate) const
+{
+	return RoomTiles.Contains(Coordinate) || RoomRects.Contains(Coordinate);
+}
+
+bool USimpleGridDungeonLayout::IsCorridorTile(const FGridCoordinate& Coordinate) const
+{
+	return CorridorTiles.Contains(Coordinate) || CorridorRects.Contains(Coordinate);
+}
+
+bool USimpleGridDungeonLayout::IsFloorTile(const FGridCoordinate& Coordinate) const
+{
+	return RoomTiles.Contains(Coordinate) || CorridorTiles.Contains(Coordinate) || IsRectTile(Coordinate);
 }
 
 TArray<FGridEdge> USimpleGridDungeonLayout::GetDoorPositions(const float GridSize) const
 {
-	TArray<FGridEdge> DoorPositions = Doors.Array();
-	return DoorPositions;
+	return TArray<FGridEdge>(ViewDoorPositions());
 }
 
 TArray<FGridEdge> USimpleGridDungeonLayout::GetWallPositions(const float GridSize) const
+{
+	return TArray<FGridEdge>(ViewWallPositions());
+}
+
+TArray<FGridCorner> USimpleGridDungeonLayout::GetCornerPillarPositions(const float GridSize) const
+{
+	return TArray<FGridCorner>(ViewCornerPillarPositions());
+}
+
+TConstArrayView<FGridEdge> USimpleGridDungeonLayout::ViewDoorPositions() const
+{
+	const uint64 Stamp = GetDerivedDataStamp();
+	if (CachedDoorPositionsStamp != Stamp)
+	{
+		CachedDoorPositions = Doors.Array();
+		CachedDoorPositionsStamp = Stamp;
+	}
+	return CachedDoorPositions;
+}
+
+TConstArrayView<FGridEdge> USimpleGridDungeonLayout::ViewWallPositions() const
+{
+	const uint64 Stamp = GetDerivedDataStamp();
+	if (CachedWallPositionsStamp != Stamp)
+	{
+		CachedWallPositions.Reset();
+		ComputeWallPositions(CachedWallPositions);
+		CachedWallPositionsStamp = Stamp;
+	}
+	return CachedWallPositions;
+}
+
+TConstArrayView<FGridCorner> USimpleGridDungeonLayout::ViewCornerPillarPositions() const
+{
+	const uint64 Stamp = GetDerivedDataStamp();
+	if (CachedCornerPillarPositionsStamp != Stamp)
+	{
+		CachedCornerPillarPositions.Reset();
+		ComputeCornerPillarPositions(CachedCornerPillarPositions);
+		CachedCornerPillarPositionsStamp = Stamp;
+	}
+	return CachedCornerPillarPositions;
+}
+
+uint64 USimpleGridDungeonLayout::GetDerivedDataStamp() const
+{
+	return (static_cast<uint64>(Version) << 2) | (bImputesWallPositions ? 1 : 0) | (bImputesCornerPillarPositions ? 2 : 0);
+}
+
+const FGridTileBitmap& USimpleGridDungeonLayout::GetCachedFloorTiles() const
+{
+	const uint64 Stamp = GetDerivedDataStamp();
+	if (CachedFloorTilesStamp != Stamp)
+	{
+		CachedFloorTiles = RoomTiles;
+		CachedFloorTiles.Union(CorridorTiles);
+		CachedFloorTilesStamp = Stamp;
+	}
+	return CachedFloorTiles;
+}
+
+uint8 USimpleGridDungeonLayout::GetFloorTileMask(const FGridCoordinate& BottomLeftTile) const
+{
+	const FGridCoordinate& BL = BottomLeftTile;
+	return (IsFloorTile(BL) ? 1 : 0)
+		| (IsFloorTile(FGridCoordinate(BL.X + 1, BL.Y)) ? 2 : 0)
+		| (IsFloorTile(FGridCoordinate(BL.X + 1, BL.Y + 1)) ? 4 : 0)
+		| (IsFloorTile(FGridCoordinate(BL.X, BL.Y + 1)) ? 8 : 0);
+}
+
+void USimpleGridDungeonLayout::ComputeWallPositions(TArray<FGridEdge>& OutWallPositions) const
 {
 	if (!bImputesWallPositions)
 	{
 		// Make sure to exclude any possible door tiles that may overlap with the wall tiles.
-		return Walls.Difference(Doors).Array();
+		OutWallPositions = Walls.Difference(Doors).Array();
+		return;
 	}
-	
-	TSet<FGridEdge> WallPositions;
 
-	// Find all the coordinates that are adjacent to a floor tile and add a wall between them if the adjacent tile is not a floor tile.
-	TSet<FGridCoordinate> AllCoordinates = TSet<FGridCoordinate>(GetAllFloorTiles());
-	for (const FGridCoordinate& Coord : AllCoordinates)
+	// Every floor tile with a non-floor neighbour gets a wall between them. The bitmap finds these a row at a time,
+	// and visits each tile/neighbour pair once, so there is nothing to deduplicate.
+	const bool bHasRects = HasRects();
+	GetCachedFloorTiles().ForEachBoundaryEdge([this, bHasRects, &OutWallPositions](const FGridCoordinate& Coord, const FGridCoordinate& NeighbourCoord)
 	{
-		for (const FGridCoordinate& NeighbourCoord : UGridCoordinateHelperLibrary::GetAdjacentCoordinates(Coord))
-		{
-			if (!AllCoordinates.Contains(NeighbourCoord))
-			{
-				WallPositions.Add(FGridEdge(Coord, NeighbourCoord));
-			}
-		}
-	}
+		if (bHasRects && IsRectTile(NeighbourCoord)) return;
+		OutWallPositions.Add(FGridEdge(Coord, NeighbourCoord));
+	});
 
-	return WallPositions.Array();
+	// Rectangles only need their perimeters walking, so this scales with the number of rooms rather than their area
+	const auto AddRectWall = [this, &OutWallPositions](const FGridCoordinate& Coord, const FGridCoordinate& NeighbourCoord)
+	{
+		if (IsFloorTile(NeighbourCoord)) return;
+		OutWallPositions.Add(FGridEdge(Coord, NeighbourCoord));
+	};
+	RoomRects.ForEachBoundaryEdge(AddRectWall);
+	CorridorRects.ForEachBoundaryEdge(AddRectWall);
 }
 
-TArray<FGridCorner> USimpleGridDungeonLayout::GetCornerPillarPositions(const float GridSize) const
+void USimpleGridDungeonLayout::ComputeCornerPillarPositions(TArray<FGridCorner>& OutCornerPillarPositions) const
 {
 	if (!bImputesCornerPillarPositions)
 	{
-		return CornerPillars.Array();
+		OutCornerPillarPositions = CornerPillars.Array();
+		return;
 	}
 
-	TArray<FGridCorner> CornerPillarPositions;
-
-	const TArray<FGridEdge> AllWalls = GetWallPositions(GridSize);
+	if (bImputesWallPositions && HasRects())
+	{
+		// Only vertices on the boundary of the tiles or a rectangle can be corners, but a vertex can be on several of those boundaries at once
+		TSet<uint64> VisitedVertices;
+		const auto VisitVertex = [this, &VisitedVertices, &OutCornerPillarPositions](const FGridCoordinate& BottomLeftTile)
+		{
+			bool bAlreadyVisited = false;
+			VisitedVertices.Add(BottomLeftTile.GetPackedKey(), &bAlreadyVisited);
+			if (!bAlreadyVisited && FGridCorner::CornerFromTileMask[GetFloorTileMask(BottomLeftTile)])
+			{
+				OutCornerPillarPositions.Add(FGridCorner::FromVertex(BottomLeftTile));
+			}
+		};
+		GetCachedFloorTiles().ForEachBoundaryVertex([&VisitVertex](const FGridCoordinate& BottomLeftTile, const uint8 TileMask) { VisitVertex(BottomLeftTile); });
+		RoomRects.ForEachBoundaryVertex(VisitVertex);
+		CorridorRects.ForEachBoundaryVertex(VisitVertex);
+		return;
+	}
 
-	for (const FGridEdge EdgeA : AllWalls)
+	if (bImputesWallPositions)
 	{
-		for (const FGridEdge EdgeB : AllWalls)
+		// Walls lie between every floor and non-floor tile, so each vertex can be classified from the floor tiles around it
+		GetCachedFloorTiles().ForEachBoundaryVertex([&OutCornerPillarPositions](const FGridCoordinate& BottomLeftTile, const uint8 TileMask)
 		{
-			if (EdgeA.FormsCorner(EdgeB))
+			if (FGridCorner::CornerFromTileMask[TileMask])
 			{
-				CornerPillarPositions.Add(FGridCorner::FromEdges(EdgeA, EdgeB));
+				OutCornerPillarPositions.Add(FGridCorner::FromVertex(BottomLeftTile));
 			}
+		});
+		return;
+	}
+
+	// Explicit walls can't be derived from the floor, so mark which of the four edges around each vertex are walls instead.
+	// Edge bits follow FGridCorner::CornerFromEdgeMask: 0 bottom, 1 right, 2 top, 3 left of the vertex.
+	TMap<uint64, uint8> VertexEdgeMasks;
+	for (FGridEdge Wall : ViewWallPositions())
+	{
+		Wall.Sort();
+		const FGridCoordinate& A = Wall.CoordinateA;
+		const FGridCoordinate& B = Wall.CoordinateB;
+		if (A.Y == B.Y && B.X == A.X + 1)
+		{
+			VertexEdgeMasks.FindOrAdd(A.GetPackedKey()) |= 1 << 0;
+			VertexEdgeMasks.FindOrAdd(FGridCoordinate(A.X, A.Y - 1).GetPackedKey()) |= 1 << 2;
+		}
+		else if (A.X == B.X && B.Y == A.Y + 1)
+		{
+			VertexEdgeMasks.FindOrAdd(A.GetPackedKey()) |= 1 << 3;
+			VertexEdgeMasks.FindOrAdd(FGridCoordinate(A.X - 1, A.Y).GetPackedKey()) |= 1 << 1;
 		}
 	}
 
-	return CornerPillarPositions;
+	for (const TPair<uint64, uint8>& VertexEdgeMask : VertexEdgeMasks)
+	{
+		if (FGridCorner::CornerFromEdgeMask[VertexEdgeMask.Value])
+		{
+			OutCornerPillarPositions.Add(FGridCorner::FromVertex(FGridCoordinate::FromPackedKey(VertexEdgeMask.Key)));
+		}
+	}
 }
 
 void USimpleGridDungeonLayout::AddRoomTiles(const TArray<FGridCoordinate>& InRoomTiles)
 {
 	this->RoomTiles.Append(InRoomTiles);
+	Version++;
 }
 
 void USimpleGridDungeonLayout::AddCorridorTiles(const TArray<FGridCoordinate>& InCorridorTiles)
 {
 	this->CorridorTiles.Append(InCorridorTiles);
+	Version++;
+}
+
+void USimpleGridDungeonLayout::AddRoomRects(const TArray<FRectBox>& InRoomRects)
+{
+	this->RoomRects.Append(InRoomRects);
+	Version++;
+}
+
+void USimpleGridDungeonLayout::AddCorridorRects(const TArray<FRectBox>& InCorridorRects)
+{
+	this->CorridorRects.Append(InCorridorRects);
+	Version++;
 }
 
 void USimpleGridDungeonLayout::AddWalls(const TArray<FGridEdge>& InWallLocations)
 {
 	this->Walls.Append(InWallLocations);
+	Version++;
 }
 
 void USimpleGridDungeonLayout::AddDoors(const TArray<FGridEdge>& InDoorLocations)
 {
 	this->Doors.Append(InDoorLocations);
+	Version++;
+}
+
+SIZE_T USimpleGridDungeonLayout::GetTileAllocatedSize() const
+{
+	return RoomTiles.GetAllocatedSize() + CorridorTiles.GetAllocatedSize() + RoomRects.GetAllocatedSize() + CorridorRects.GetAllocatedSize();
 }
 
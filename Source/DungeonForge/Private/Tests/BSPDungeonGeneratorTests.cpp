@@ -0,0 +1,300 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Generators/BSPDungeonGenerator.h"
+
+#include "Async/ParallelFor.h"
+#include "Layouts/GridTileBitmap.h"
+#include "Layouts/SimpleGridDungeonLayout.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	/**
+	 * Settings for a square area big enough to be split into RoomCount rooms, about 8x8 tiles of area per room.
+	 */
+	FBSPGenerationSettings MakeSettingsForRoomCount(const int32 RoomCount, const bool bRecursiveSubdivision = false)
+	{
+		FBSPGenerationSettings Settings;
+		Settings.GridWidth = FMath::CeilToInt(FMath::Sqrt(static_cast<double>(RoomCount))) * 8;
+		Settings.GridHeight = Settings.GridWidth;
+		Settings.RoomCount = RoomCount;
+		Settings.bRecursiveSubdivision = bRecursiveSubdivision;
+		return Settings;
+	}
+
+	UBSPDungeonGenerator* MakeGenerator(const FBSPGenerationSettings& Settings)
+	{
+		UBSPDungeonGenerator* Generator = NewObject<UBSPDungeonGenerator>();
+		Generator->SetGenerationSettings(Settings);
+		return Generator;
+	}
+
+	/**
+	 * @return True if the rooms are inside the area and no two of them share a tile.
+	 */
+	bool AreRoomsDisjointAndInside(const TArray<FRectBox>& Rooms, const FBSPGenerationSettings& Settings)
+	{
+		FGridTileBitmap Tiles;
+		int64 TotalVolume = 0;
+		for (const FRectBox& Room : Rooms)
+		{
+			if (Room.BoxOrigin.X < 0 || Room.BoxOrigin.Y < 0 || Room.BoxBound.X >= Settings.GridWidth || Room.BoxBound.Y >= Settings.GridHeight) return false;
+			TotalVolume += Room.GetVolume();
+			for (int32 X = Room.BoxOrigin.X; X <= Room.BoxBound.X; X++)
+			{
+				for (int32 Y = Room.BoxOrigin.Y; Y <= Room.BoxBound.Y; Y++)
+				{
+					Tiles.Add(FGridCoordinate(X, Y));
+				}
+			}
+		}
+		return Tiles.Num() == TotalVolume;
+	}
+
+	/**
+	 * @return True if B starts exactly CorridorWidth tiles after A ends along the axis, and the two share at least one tile of span across it.
+	 */
+	bool AreRoomsFacing(const FRectBox& A, const FRectBox& B, const int32 CorridorWidth, const int32 Axis)
+	{
+		if (Axis == 0)
+		{
+			return A.BoxBound.X + CorridorWidth + 1 == B.BoxOrigin.X && FMath::Max(A.BoxOrigin.Y, B.BoxOrigin.Y) <= FMath::Min(A.BoxBound.Y, B.BoxBound.Y);
+		}
+		return A.BoxBound.Y + CorridorWidth + 1 == B.BoxOrigin.Y && FMath::Max(A.BoxOrigin.X, B.BoxOrigin.X) <= FMath::Min(A.BoxBound.X, B.BoxBound.X);
+	}
+
+	/**
+	 * Finds every ordered pair of rooms facing each other across a gap by testing every pair, as the reference for the sweep.
+	 */
+	TSet<TPair<int32, int32>> FindFacingRoomsBruteForce(const TArray<FRectBox>& Rooms, const int32 CorridorWidth)
+	{
+		TSet<TPair<int32, int32>> FacingRooms;
+		for (int32 RoomA = 0; RoomA < Rooms.Num(); RoomA++)
+		{
+			for (int32 RoomB = 0; RoomB < Rooms.Num(); RoomB++)
+			{
+				if (AreRoomsFacing(Rooms[RoomA], Rooms[RoomB], CorridorWidth, 0) || AreRoomsFacing(Rooms[RoomA], Rooms[RoomB], CorridorWidth, 1))
+				{
+					FacingRooms.Add(TPair<int32, int32>(RoomA, RoomB));
+				}
+			}
+		}
+		return FacingRooms;
+	}
+
+	bool AreRectsEqual(const TArray<FRectBox>& A, const TArray<FRectBox>& B)
+	{
+		if (A.Num() != B.Num()) return false;
+		for (int32 i = 0; i < A.Num(); i++)
+		{
+			if (A[i].BoxOrigin != B[i].BoxOrigin || A[i].BoxBound != B[i].BoxBound) return false;
+		}
+		return true;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBSPHeapSplitPerfTest, "DungeonForge.BSPGenerator.Perf.HeapSplit", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FBSPHeapSplitPerfTest::RunTest(const FString& Parameters)
+{
+	// Re-sorting every iteration is quadratic, so it is only timed at the smaller sizes
+	constexpr int32 MaxSortedRoomCount = 4000;
+	double PreviousSeconds = 0.0;
+	int32 PreviousRoomCount = 0;
+	for (const int32 RoomCount : { 1000, 2000, 4000, 8000, 16000, 32000, 64000, 128000 })
+	{
+		const FBSPGenerationSettings Settings = MakeSettingsForRoomCount(RoomCount);
+		const FRectBox Area(FGridCoordinate(), FGridCoordinate(Settings.GridWidth - 1, Settings.GridHeight - 1));
+
+		TArray<FRectBox> Rooms;
+		const double StartTime = FPlatformTime::Seconds();
+		UBSPDungeonGenerator::SubdivideWidestFirst(Area, RoomCount, 0, Settings, Rooms);
+		const double Seconds = FPlatformTime::Seconds() - StartTime;
+
+		TestEqual(FString::Printf(TEXT("%d leaves are generated"), RoomCount), Rooms.Num(), RoomCount);
+		TestTrue(FString::Printf(TEXT("%d leaves don't overlap"), RoomCount), AreRoomsDisjointAndInside(Rooms, Settings));
+
+		// n log n doubles and a bit each time n doubles, so the time per n log n should stay flat
+		const double NLogN = RoomCount * FMath::Log2(static_cast<double>(RoomCount));
+		FString Report = FString::Printf(TEXT("%d leaves: heap split %.2f ms, %.2f ns per n log n"), RoomCount, Seconds * 1000.0, Seconds * 1e9 / NLogN);
+		if (PreviousRoomCount > 0)
+		{
+			const double ExpectedRatio = NLogN / (PreviousRoomCount * FMath::Log2(static_cast<double>(PreviousRoomCount)));
+			Report += FString::Printf(TEXT(", %.2fx the time for %d leaves (n log n predicts %.2fx)"), Seconds / FMath::Max(PreviousSeconds, UE_DOUBLE_SMALL_NUMBER), PreviousRoomCount, ExpectedRatio);
+		}
+		PreviousSeconds = Seconds;
+		PreviousRoomCount = RoomCount;
+
+		if (RoomCount <= MaxSortedRoomCount)
+		{
+			// The split loop as it was before the heap: sort every room by extent to find the widest, on every iteration
+			FRandomStream RandomStream(0);
+			TArray<FRectBox> SortedRooms = { Area };
+			const double SortedStartTime = FPlatformTime::Seconds();
+			for (int32 i = 1; i < RoomCount; i++)
+			{
+				SortedRooms.Sort([](const FRectBox& A, const FRectBox& B) { return A.GetExtent() < B.GetExtent(); });
+				FRectBox BoxA;
+				FRectBox BoxB;
+				if (!UBSPDungeonGenerator::ChooseRandomBoxSplit(SortedRooms.Last(), Settings.CorridorWidth, Settings.MinRoomWidth, RandomStream, BoxA, BoxB)) break;
+				SortedRooms.Pop();
+				SortedRooms.Add(BoxA);
+				SortedRooms.Add(BoxB);
+			}
+			const double SortedSeconds = FPlatformTime::Seconds() - SortedStartTime;
+
+			TestEqual(FString::Printf(TEXT("%d leaves are generated by sorting"), RoomCount), SortedRooms.Num(), RoomCount);
+			Report += FString::Printf(TEXT("; sort each iteration %.2f ms (%.1fx the heap)"), SortedSeconds * 1000.0, SortedSeconds / FMath::Max(Seconds, UE_DOUBLE_SMALL_NUMBER));
+		}
+		AddInfo(Report);
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBSPRecursiveDeterminismTest, "DungeonForge.BSPGenerator.RecursiveSameSeedSameRooms", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FBSPRecursiveDeterminismTest::RunTest(const FString& Parameters)
+{
+	// A low threshold forks most of the tree onto the task graph, so the order subtrees finish in varies from run to run
+	FBSPGenerationSettings Settings = MakeSettingsForRoomCount(2000, true);
+	Settings.ParallelSubdivisionMinArea = 256;
+	const UBSPDungeonGenerator* Generator = MakeGenerator(Settings);
+
+	FBSPGenerationSettings SerialSettings = Settings;
+	SerialSettings.ParallelSubdivisionMinArea = MAX_int32;
+	FSimpleGridLayoutData SerialLayout;
+	MakeGenerator(SerialSettings)->GenerateLayoutData(99, SerialLayout);
+	TestTrue(TEXT("Recursive rooms don't overlap"), AreRoomsDisjointAndInside(SerialLayout.RoomRects, Settings));
+
+	// Generate the same seed several times at once, each generation forking its own subtrees
+	constexpr int32 NumRuns = 8;
+	TArray<FSimpleGridLayoutData> Layouts;
+	Layouts.SetNum(NumRuns);
+	ParallelFor(NumRuns, [&](const int32 Run)
+	{
+		Generator->GenerateLayoutData(99, Layouts[Run]);
+	});
+
+	for (int32 Run = 0; Run < NumRuns; Run++)
+	{
+		TestTrue(FString::Printf(TEXT("Run %d generates the same rooms as a serial split"), Run), AreRectsEqual(Layouts[Run].RoomRects, SerialLayout.RoomRects));
+		TestTrue(FString::Printf(TEXT("Run %d generates the same corridors as a serial split"), Run), AreRectsEqual(Layouts[Run].CorridorRects, SerialLayout.CorridorRects));
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBSPRecursivePerfTest, "DungeonForge.BSPGenerator.Perf.ParallelRecursiveSplit", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FBSPRecursivePerfTest::RunTest(const FString& Parameters)
+{
+	for (const int32 RoomCount : { 10000, 100000 })
+	{
+		FBSPGenerationSettings SerialSettings = MakeSettingsForRoomCount(RoomCount, true);
+		SerialSettings.ParallelSubdivisionMinArea = MAX_int32;
+		const FBSPGenerationSettings ParallelSettings = MakeSettingsForRoomCount(RoomCount, true);
+
+		FSimpleGridLayoutData SerialLayout;
+		double StartTime = FPlatformTime::Seconds();
+		MakeGenerator(SerialSettings)->GenerateLayoutData(0, SerialLayout);
+		const double SerialSeconds = FPlatformTime::Seconds() - StartTime;
+
+		FSimpleGridLayoutData ParallelLayout;
+		StartTime = FPlatformTime::Seconds();
+		MakeGenerator(ParallelSettings)->GenerateLayoutData(0, ParallelLayout);
+		const double ParallelSeconds = FPlatformTime::Seconds() - StartTime;
+
+		TestTrue(FString::Printf(TEXT("%d rooms are the same split serially and in parallel"), RoomCount), AreRectsEqual(SerialLayout.RoomRects, ParallelLayout.RoomRects));
+
+		AddInfo(FString::Printf(TEXT("%d rooms on a %dx%d grid: serial recursive %.2f ms, parallel recursive %.2f ms (%.2fx), including connections"),
+			RoomCount, SerialSettings.GridWidth, SerialSettings.GridHeight, SerialSeconds * 1000.0, ParallelSeconds * 1000.0, SerialSeconds / FMath::Max(ParallelSeconds, UE_DOUBLE_SMALL_NUMBER)));
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBSPConnectionsTest, "DungeonForge.BSPGenerator.ConnectionsJoinFacingRooms", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FBSPConnectionsTest::RunTest(const FString& Parameters)
+{
+	for (const int32 CorridorWidth : { 1, 3 })
+	{
+		for (const bool bRecursiveSubdivision : { false, true })
+		{
+			FBSPGenerationSettings Settings = MakeSettingsForRoomCount(200, bRecursiveSubdivision);
+			Settings.CorridorWidth = CorridorWidth;
+			const FString Context = FString::Printf(TEXT("corridor width %d, recursive %d"), CorridorWidth, bRecursiveSubdivision);
+
+			FSimpleGridLayoutData LayoutData;
+			TArray<FBSPRoomConnection> Connections;
+			MakeGenerator(Settings)->GenerateLayoutData(5, LayoutData, Connections);
+			const TArray<FRectBox>& Rooms = LayoutData.RoomRects;
+
+			TSet<TPair<int32, int32>> ConnectedRooms;
+			for (const FBSPRoomConnection& Connection : Connections)
+			{
+				const FRectBox& RoomA = Rooms[Connection.RoomA];
+				const FRectBox& RoomB = Rooms[Connection.RoomB];
+				const bool bAlongX = AreRoomsFacing(RoomA, RoomB, CorridorWidth, 0);
+				const bool bAlongY = AreRoomsFacing(RoomA, RoomB, CorridorWidth, 1);
+				TestTrue(FString::Printf(TEXT("Rooms %d and %d face each other across the gap (%s)"), Connection.RoomA, Connection.RoomB, *Context), bAlongX || bAlongY);
+
+				// The corridor fills the gap between the two rooms, and each door joins a room to an end of the corridor.
+				// Edges sort their coordinates by packed key, so either end of a door may be the room's.
+				const FRectBox& Corridor = Connection.Corridor;
+				const auto JoinsRoomToCorridor = [&Corridor](const FGridEdge& Door, const FRectBox& Room)
+				{
+					return (Room.Contains(Door.CoordinateA) && Corridor.Contains(Door.CoordinateB)) || (Room.Contains(Door.CoordinateB) && Corridor.Contains(Door.CoordinateA));
+				};
+				const FGridCoordinate ExpectedOrigin = bAlongX ? FGridCoordinate(RoomA.BoxBound.X + 1, Corridor.BoxOrigin.Y) : FGridCoordinate(Corridor.BoxOrigin.X, RoomA.BoxBound.Y + 1);
+				const FGridCoordinate ExpectedBound = bAlongX ? FGridCoordinate(RoomB.BoxOrigin.X - 1, Corridor.BoxOrigin.Y) : FGridCoordinate(Corridor.BoxOrigin.X, RoomB.BoxOrigin.Y - 1);
+				TestTrue(FString::Printf(TEXT("Corridor of rooms %d and %d spans the gap (%s)"), Connection.RoomA, Connection.RoomB, *Context), Corridor.BoxOrigin == ExpectedOrigin && Corridor.BoxBound == ExpectedBound);
+				TestTrue(FString::Printf(TEXT("Door A of rooms %d and %d joins room A to the corridor (%s)"), Connection.RoomA, Connection.RoomB, *Context),
+					JoinsRoomToCorridor(Connection.DoorA, RoomA));
+				TestTrue(FString::Printf(TEXT("Door B of rooms %d and %d joins room B to the corridor (%s)"), Connection.RoomA, Connection.RoomB, *Context),
+					JoinsRoomToCorridor(Connection.DoorB, RoomB));
+
+				const TPair<int32, int32> Pair(FMath::Min(Connection.RoomA, Connection.RoomB), FMath::Max(Connection.RoomA, Connection.RoomB));
+				TestFalse(FString::Printf(TEXT("Rooms %d and %d are only connected once (%s)"), Pair.Key, Pair.Value, *Context), ConnectedRooms.Contains(Pair));
+				ConnectedRooms.Add(Pair);
+			}
+
+			// Every facing pair gets a corridor
+			const TSet<TPair<int32, int32>> FacingRooms = FindFacingRoomsBruteForce(Rooms, CorridorWidth);
+			TestEqual(FString::Printf(TEXT("Every facing pair of rooms is connected (%s)"), *Context), Connections.Num(), FacingRooms.Num());
+		}
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBSPConnectionsPerfTest, "DungeonForge.BSPGenerator.Perf.ConnectFacingRooms", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FBSPConnectionsPerfTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 RoomCount = 10000;
+	const FBSPGenerationSettings Settings = MakeSettingsForRoomCount(RoomCount);
+
+	FSimpleGridLayoutData LayoutData;
+	TArray<FBSPRoomConnection> Connections;
+	double StartTime = FPlatformTime::Seconds();
+	MakeGenerator(Settings)->GenerateLayoutData(0, LayoutData, Connections);
+	const double GenerationSeconds = FPlatformTime::Seconds() - StartTime;
+
+	StartTime = FPlatformTime::Seconds();
+	const TSet<TPair<int32, int32>> FacingRooms = FindFacingRoomsBruteForce(LayoutData.RoomRects, Settings.CorridorWidth);
+	const double BruteForceSeconds = FPlatformTime::Seconds() - StartTime;
+
+	TestEqual(TEXT("The sweep connects every facing pair the brute force search finds"), Connections.Num(), FacingRooms.Num());
+
+	AddInfo(FString::Printf(TEXT("%d leaves, %d connections: generation with sweep %.2f ms, brute force facing search alone %.2f ms"),
+		LayoutData.RoomRects.Num(), Connections.Num(), GenerationSeconds * 1000.0, BruteForceSeconds * 1000.0));
+
+	return true;
+}
+
+#endif
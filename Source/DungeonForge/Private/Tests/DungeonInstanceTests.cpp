@@ -0,0 +1,433 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Instances/BSPDungeonInstance.h"
+
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Engine/Engine.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/World.h"
+#include "Generators/BSPDungeonGenerator.h"
+#include "Layouts/SimpleGridDungeonLayout.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	constexpr int32 NumCategories = static_cast<int32>(EDungeonMeshCategory::Num);
+
+	/**
+	 * A world for a test to spawn dungeons in, destroyed with the scope. A game world unless told otherwise.
+	 */
+	struct FDungeonTestWorld
+	{
+		UWorld* World;
+
+		explicit FDungeonTestWorld(const EWorldType::Type WorldType = EWorldType::Game)
+		{
+			World = UWorld::CreateWorld(WorldType, false);
+			FWorldContext& WorldContext = GEngine->CreateNewWorldContext(WorldType);
+			WorldContext.SetCurrentWorld(World);
+		}
+
+		~FDungeonTestWorld()
+		{
+			GEngine->DestroyWorldContext(World);
+			World->DestroyWorld(false);
+		}
+	};
+
+	/**
+	 * Sets a property by name, the way the editor and Blueprints do, so tests can configure the dungeon's protected settings.
+	 */
+	template <typename ValueType>
+	void SetPropertyValue(UObject* Object, const FName PropertyName, const ValueType& Value)
+	{
+		const FProperty* Property = FindFProperty<FProperty>(Object->GetClass(), PropertyName);
+		check(Property && Property->GetElementSize() == sizeof(ValueType));
+		*Property->ContainerPtrToValuePtr<ValueType>(Object) = Value;
+	}
+
+	template <typename ValueType>
+	ValueType GetPropertyValue(const UObject* Object, const FName PropertyName)
+	{
+		const FProperty* Property = FindFProperty<FProperty>(Object->GetClass(), PropertyName);
+		check(Property && Property->GetElementSize() == sizeof(ValueType));
+		return *Property->ContainerPtrToValuePtr<ValueType>(Object);
+	}
+
+	/**
+	 * Every category gets a different mesh, so the components a dungeon spawns can be told apart by their mesh.
+	 */
+	const FName CategoryMeshProperties[NumCategories] = { TEXT("RoomFloorMesh"), TEXT("CorridorFloorMesh"), TEXT("WallMesh"), TEXT("DoorMesh"), TEXT("PillarMesh") };
+	const TCHAR* CategoryMeshPaths[NumCategories] = {
+		TEXT("/Engine/BasicShapes/Plane.Plane"), TEXT("/Engine/BasicShapes/Cube.Cube"), TEXT("/Engine/BasicShapes/Cylinder.Cylinder"),
+		TEXT("/Engine/BasicShapes/Cone.Cone"), TEXT("/Engine/BasicShapes/Sphere.Sphere") };
+
+	int32 GetCategoryForMesh(const UStaticMesh* Mesh)
+	{
+		for (int32 CategoryIndex = 0; CategoryIndex < NumCategories; CategoryIndex++)
+		{
+			if (Mesh && Mesh->GetPathName() == CategoryMeshPaths[CategoryIndex]) return CategoryIndex;
+		}
+		return INDEX_NONE;
+	}
+
+	FBSPGenerationSettings MakeTestGenerationSettings()
+	{
+		FBSPGenerationSettings Settings;
+		Settings.GridWidth = 48;
+		Settings.GridHeight = 40;
+		Settings.RoomCount = 24;
+		return Settings;
+	}
+
+	/**
+	 * Spawns a BSP dungeon actor set up to generate the test layout with a fixed seed. Call GenerateDungeon to spawn the dungeon itself.
+	 */
+	ABSPDungeonInstance* SpawnTestDungeon(UWorld* World, const FVector& Location, const int32 CellSize, const int32 Seed = 3)
+	{
+		ABSPDungeonInstance* Dungeon = World->SpawnActor<ABSPDungeonInstance>(Location, FRotator::ZeroRotator);
+		SetPropertyValue(Dungeon, TEXT("GenerationSettings"), MakeTestGenerationSettings());
+		SetPropertyValue(Dungeon, TEXT("CellSize"), CellSize);
+		SetPropertyValue(Dungeon, TEXT("bRandomiseSeed"), false);
+		Dungeon->Seed = Seed;
+		Dungeon->GridSize = 100.0f;
+		for (int32 CategoryIndex = 0; CategoryIndex < NumCategories; CategoryIndex++)
+		{
+			SetPropertyValue(Dungeon, CategoryMeshProperties[CategoryIndex], LoadObject<UStaticMesh>(nullptr, CategoryMeshPaths[CategoryIndex]));
+		}
+		return Dungeon;
+	}
+
+	/**
+	 * @return The number of instances of each category in the test layout for a seed, counted from the layout itself.
+	 */
+	TArray<int32> GetExpectedInstanceCounts(const int32 Seed)
+	{
+		UBSPDungeonGenerator* Generator = NewObject<UBSPDungeonGenerator>();
+		Generator->SetGenerationSettings(MakeTestGenerationSettings());
+		const USimpleGridDungeonLayout* Layout = Generator->GenerateLayout(Seed);
+
+		TArray<int32> Counts;
+		Counts.SetNumZeroed(NumCategories);
+		Layout->ForEachRoomTile([&Counts](const FGridCoordinate&) { Counts[static_cast<int32>(EDungeonMeshCategory::RoomFloor)]++; });
+		Layout->ForEachCorridorTile([&Counts](const FGridCoordinate&) { Counts[static_cast<int32>(EDungeonMeshCategory::CorridorFloor)]++; });
+		Counts[static_cast<int32>(EDungeonMeshCategory::Wall)] = Layout->ViewWallPositions().Num();
+		Counts[static_cast<int32>(EDungeonMeshCategory::Door)] = Layout->ViewDoorPositions().Num();
+		Counts[static_cast<int32>(EDungeonMeshCategory::Pillar)] = Layout->ViewCornerPillarPositions().Num();
+		return Counts;
+	}
+
+	/**
+	 * @return The cell an instance at this position relative to the dungeon is bucketed in. Edges and corners lie on multiples of half a tile,
+	 * so they are nudged a quarter tile up before rounding down, which keeps the ones on a cell boundary in the cell below it.
+	 */
+	FGridCoordinate GetCellForLocalPosition(const FVector& Position, const float GridSize, const int32 CellSize)
+	{
+		return FGridCoordinate(
+			FMath::FloorToInt((Position.X / GridSize + 0.25) / CellSize),
+			FMath::FloorToInt((Position.Y / GridSize + 0.25) / CellSize));
+	}
+
+	/**
+	 * @return A layout of one square room, with an extra tile sticking out of the middle of one side if requested.
+	 */
+	USimpleGridDungeonLayout* MakeSquareRoomLayout(UObject* Outer, const int32 RoomSize, const bool bAddExtraTile)
+	{
+		TArray<FGridCoordinate> RoomTiles;
+		for (int32 X = 0; X < RoomSize; X++)
+		{
+			for (int32 Y = 0; Y < RoomSize; Y++)
+			{
+				RoomTiles.Add(FGridCoordinate(X, Y));
+			}
+		}
+		if (bAddExtraTile)
+		{
+			RoomTiles.Add(FGridCoordinate(RoomSize, RoomSize / 2));
+		}
+
+		USimpleGridDungeonLayout* Layout = NewObject<USimpleGridDungeonLayout>(Outer);
+		Layout->AddRoomTiles(RoomTiles);
+		return Layout;
+	}
+
+	using FInstanceSnapshot = TMap<const UInstancedStaticMeshComponent*, TArray<FTransform>>;
+
+	FInstanceSnapshot TakeInstanceSnapshot(const AActor* Dungeon)
+	{
+		FInstanceSnapshot Snapshot;
+		TInlineComponentArray<UInstancedStaticMeshComponent*> Components(Dungeon);
+		for (const UInstancedStaticMeshComponent* Component : Components)
+		{
+			TArray<FTransform>& Transforms = Snapshot.Add(Component);
+			Transforms.SetNum(Component->GetInstanceCount());
+			for (int32 InstanceIndex = 0; InstanceIndex < Transforms.Num(); InstanceIndex++)
+			{
+				Component->GetInstanceTransform(InstanceIndex, Transforms[InstanceIndex], false);
+			}
+		}
+		return Snapshot;
+	}
+
+	/**
+	 * @return The number of instance indices whose transform was added, removed or changed between the snapshots, across every component.
+	 */
+	int32 CountTouchedInstances(const FInstanceSnapshot& Before, const FInstanceSnapshot& After)
+	{
+		int32 NumTouched = 0;
+		for (const TPair<const UInstancedStaticMeshComponent*, TArray<FTransform>>& Pair : After)
+		{
+			const TArray<FTransform>* BeforeTransforms = Before.Find(Pair.Key);
+			if (!BeforeTransforms)
+			{
+				NumTouched += Pair.Value.Num();
+				continue;
+			}
+			for (int32 InstanceIndex = 0; InstanceIndex < FMath::Max(Pair.Value.Num(), BeforeTransforms->Num()); InstanceIndex++)
+			{
+				if (!Pair.Value.IsValidIndex(InstanceIndex) || !BeforeTransforms->IsValidIndex(InstanceIndex) || !Pair.Value[InstanceIndex].Equals((*BeforeTransforms)[InstanceIndex]))
+				{
+					NumTouched++;
+				}
+			}
+		}
+		for (const TPair<const UInstancedStaticMeshComponent*, TArray<FTransform>>& Pair : Before)
+		{
+			if (!After.Contains(Pair.Key))
+			{
+				NumTouched += Pair.Value.Num();
+			}
+		}
+		return NumTouched;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDungeonComponentsPerCategoryTest, "DungeonForge.DungeonInstance.ComponentsPerCategory", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FDungeonComponentsPerCategoryTest::RunTest(const FString& Parameters)
+{
+	FDungeonTestWorld TestWorld;
+	const TArray<int32> ExpectedCounts = GetExpectedInstanceCounts(3);
+	const FVector DungeonLocation(10000.0f, -4000.0f, 250.0f);
+
+	for (const int32 CellSize : { 0, 8 })
+	{
+		ABSPDungeonInstance* Dungeon = SpawnTestDungeon(TestWorld.World, DungeonLocation, CellSize);
+		Dungeon->GenerateDungeon();
+
+		TArray<int32> NumComponents;
+		TArray<int32> NumInstances;
+		TArray<TSet<FGridCoordinate>> CategoryCells;
+		NumComponents.SetNumZeroed(NumCategories);
+		NumInstances.SetNumZeroed(NumCategories);
+		CategoryCells.SetNum(NumCategories);
+
+		TInlineComponentArray<UInstancedStaticMeshComponent*> Components(Dungeon);
+		for (const UInstancedStaticMeshComponent* Component : Components)
+		{
+			if (Component->GetInstanceCount() == 0) continue;
+			const int32 CategoryIndex = GetCategoryForMesh(Component->GetStaticMesh());
+			if (CategoryIndex == INDEX_NONE)
+			{
+				AddError(FString::Printf(TEXT("%s has instances but no category mesh"), *Component->GetName()));
+				continue;
+			}
+
+			NumComponents[CategoryIndex]++;
+			NumInstances[CategoryIndex] += Component->GetInstanceCount();
+			TestTrue(TEXT("Cell components are hierarchical and category components aren't"), Component->IsA<UHierarchicalInstancedStaticMeshComponent>() == (CellSize > 0));
+			TestTrue(TEXT("Cell components aren't saved with the level and category components are"), Component->HasAnyFlags(RF_Transient) == (CellSize > 0));
+
+			// Instances are relative to the dungeon, so they end up in the world around the actor
+			FTransform LocalTransform;
+			FTransform WorldTransform;
+			Component->GetInstanceTransform(0, LocalTransform, false);
+			Component->GetInstanceTransform(0, WorldTransform, true);
+			TestTrue(TEXT("Instances are placed relative to the dungeon actor"), WorldTransform.GetLocation().Equals(DungeonLocation + LocalTransform.GetLocation()));
+
+			if (CellSize == 0) continue;
+			const FGridCoordinate Cell = GetCellForLocalPosition(LocalTransform.GetLocation(), Dungeon->GridSize, CellSize);
+			TestFalse(FString::Printf(TEXT("Category %d has one component per cell"), CategoryIndex), CategoryCells[CategoryIndex].Contains(Cell));
+			CategoryCells[CategoryIndex].Add(Cell);
+			for (int32 InstanceIndex = 1; InstanceIndex < Component->GetInstanceCount(); InstanceIndex++)
+			{
+				Component->GetInstanceTransform(InstanceIndex, LocalTransform, false);
+				if (GetCellForLocalPosition(LocalTransform.GetLocation(), Dungeon->GridSize, CellSize) != Cell)
+				{
+					AddError(FString::Printf(TEXT("Category %d has instances from several cells in one component"), CategoryIndex));
+					break;
+				}
+			}
+		}
+
+		for (int32 CategoryIndex = 0; CategoryIndex < NumCategories; CategoryIndex++)
+		{
+			TestTrue(FString::Printf(TEXT("Category %d has instances"), CategoryIndex), ExpectedCounts[CategoryIndex] > 0);
+			TestEqual(FString::Printf(TEXT("Category %d has every instance of the layout (cell size %d)"), CategoryIndex, CellSize), NumInstances[CategoryIndex], ExpectedCounts[CategoryIndex]);
+			if (CellSize == 0)
+			{
+				TestEqual(FString::Printf(TEXT("Category %d has a single component without cells"), CategoryIndex), NumComponents[CategoryIndex], 1);
+			}
+			else
+			{
+				TestTrue(FString::Printf(TEXT("Category %d is split across several cells"), CategoryIndex), NumComponents[CategoryIndex] > 1);
+			}
+		}
+
+		Dungeon->Destroy();
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDungeonIncrementalRespawnTest, "DungeonForge.DungeonInstance.IncrementalRespawn", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FDungeonIncrementalRespawnTest::RunTest(const FString& Parameters)
+{
+	FDungeonTestWorld TestWorld;
+	constexpr int32 RoomSize = 40;
+	constexpr int32 MaxTouchedInstances = 16;
+
+	// Growing the room by one tile only adds, removes or moves the few instances around that tile
+	ABSPDungeonInstance* Dungeon = SpawnTestDungeon(TestWorld.World, FVector::ZeroVector, 8);
+	SetPropertyValue(Dungeon, TEXT("bIncrementalRespawn"), true);
+	SetPropertyValue(Dungeon, TEXT("Layout"), MakeSquareRoomLayout(Dungeon, RoomSize, false));
+	Dungeon->SpawnDungeon();
+	const FInstanceSnapshot Before = TakeInstanceSnapshot(Dungeon);
+
+	SetPropertyValue(Dungeon, TEXT("Layout"), MakeSquareRoomLayout(Dungeon, RoomSize, true));
+	Dungeon->SpawnDungeon();
+	const FInstanceSnapshot After = TakeInstanceSnapshot(Dungeon);
+
+	int32 NumInstances = 0;
+	for (const TPair<const UInstancedStaticMeshComponent*, TArray<FTransform>>& Pair : After)
+	{
+		NumInstances += Pair.Value.Num();
+	}
+	const int32 NumTouched = CountTouchedInstances(Before, After);
+	AddInfo(FString::Printf(TEXT("A one tile change touched %d of %d instances"), NumTouched, NumInstances));
+	TestTrue(TEXT("A one tile change touches some instances"), NumTouched > 0);
+	TestTrue(TEXT("A one tile change touches a constant number of instances"), NumTouched <= MaxTouchedInstances);
+	Dungeon->Destroy();
+
+	// Keys aren't saved with the level but instances are, so instances without keys are replaced rather than diffed against
+	ABSPDungeonInstance* LoadedDungeon = SpawnTestDungeon(TestWorld.World, FVector::ZeroVector, 0);
+	SetPropertyValue(LoadedDungeon, TEXT("bIncrementalRespawn"), true);
+	SetPropertyValue(LoadedDungeon, TEXT("Layout"), MakeSquareRoomLayout(LoadedDungeon, RoomSize, false));
+	UInstancedStaticMeshComponent* RoomFloorComponent = GetPropertyValue<UInstancedStaticMeshComponent*>(LoadedDungeon, TEXT("RoomFloorMeshISM"));
+	for (int32 Index = 0; Index < 5; Index++)
+	{
+		RoomFloorComponent->AddInstance(FTransform(FVector(-1000.0f * Index, 0.0f, 0.0f)));
+	}
+	LoadedDungeon->SpawnDungeon();
+	TestEqual(TEXT("Instances saved without keys are replaced by the spawned ones"), RoomFloorComponent->GetInstanceCount(), RoomSize * RoomSize);
+	LoadedDungeon->Destroy();
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDungeonEmptyCategoryRespawnTest, "DungeonForge.DungeonInstance.EmptyCategoryRespawn", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FDungeonEmptyCategoryRespawnTest::RunTest(const FString& Parameters)
+{
+	FDungeonTestWorld TestWorld;
+	constexpr int32 RoomSize = 12;
+
+	// A single room has no corridors or doors, so respawning a BSP layout as one leaves those categories with no keys at all
+	for (const int32 CellSize : { 0, 8 })
+	{
+		ABSPDungeonInstance* Dungeon = SpawnTestDungeon(TestWorld.World, FVector::ZeroVector, CellSize);
+		SetPropertyValue(Dungeon, TEXT("bIncrementalRespawn"), true);
+		Dungeon->GenerateDungeon();
+		SetPropertyValue(Dungeon, TEXT("Layout"), MakeSquareRoomLayout(Dungeon, RoomSize, false));
+		Dungeon->SpawnDungeon();
+
+		TArray<int32> NumInstances;
+		NumInstances.SetNumZeroed(NumCategories);
+		TInlineComponentArray<UInstancedStaticMeshComponent*> Components(Dungeon);
+		for (const UInstancedStaticMeshComponent* Component : Components)
+		{
+			const int32 CategoryIndex = GetCategoryForMesh(Component->GetStaticMesh());
+			if (CategoryIndex != INDEX_NONE)
+			{
+				NumInstances[CategoryIndex] += Component->GetInstanceCount();
+			}
+		}
+		TestEqual(FString::Printf(TEXT("Room floors match the new layout (cell size %d)"), CellSize), NumInstances[static_cast<int32>(EDungeonMeshCategory::RoomFloor)], RoomSize * RoomSize);
+		TestEqual(FString::Printf(TEXT("No corridor floors are left from the old layout (cell size %d)"), CellSize), NumInstances[static_cast<int32>(EDungeonMeshCategory::CorridorFloor)], 0);
+		TestEqual(FString::Printf(TEXT("No doors are left from the old layout (cell size %d)"), CellSize), NumInstances[static_cast<int32>(EDungeonMeshCategory::Door)], 0);
+		Dungeon->Destroy();
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDungeonStreamingHysteresisTest, "DungeonForge.DungeonInstance.StreamingHysteresis", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FDungeonStreamingHysteresisTest::RunTest(const FString& Parameters)
+{
+	// Not a game world and no players, so the cells are only streamed around the simulated viewer
+	FDungeonTestWorld TestWorld(EWorldType::EditorPreview);
+	const FVector DungeonLocation(10000.0f, -4000.0f, 250.0f);
+	constexpr float LoadRadius = 1000.0f;
+	constexpr float UnloadRadius = 2000.0f;
+
+	ABSPDungeonInstance* Dungeon = SpawnTestDungeon(TestWorld.World, DungeonLocation, 8);
+	SetPropertyValue(Dungeon, TEXT("bStreamCells"), true);
+	SetPropertyValue(Dungeon, TEXT("bStreamOutsideGameWorlds"), true);
+	SetPropertyValue(Dungeon, TEXT("bAutoUpdateStreaming"), false);
+	SetPropertyValue(Dungeon, TEXT("StreamingLoadRadius"), LoadRadius);
+	SetPropertyValue(Dungeon, TEXT("StreamingUnloadRadius"), UnloadRadius);
+	SetPropertyValue(Dungeon, TEXT("StreamingUpdateInterval"), 0.0f);
+	Dungeon->GenerateDungeon();
+	TestTrue(TEXT("Streams outside game worlds when asked to"), Dungeon->IsStreamingDungeon());
+	TestEqual(TEXT("No cells are loaded without viewers"), Dungeon->GetNumLoadedCells(), 0);
+
+	// Watch the cell of the room tile furthest from the dungeon's origin, so the origin isn't near it
+	FGridCoordinate FurthestTile(0, 0);
+	for (const FGridCoordinate& Tile : GetPropertyValue<USimpleGridDungeonLayout*>(Dungeon, TEXT("Layout"))->GetRoomTiles())
+	{
+		if (Tile.X + Tile.Y > FurthestTile.X + FurthestTile.Y) FurthestTile = Tile;
+	}
+	const FGridCoordinate Cell = Dungeon->GetCellForCoordinate(FurthestTile);
+	const float CellWorldSize = Dungeon->GridSize * 8;
+	const float CellMaxX = (Cell.X + 1) * CellWorldSize - Dungeon->GridSize * 0.5f;
+	const float CellCentreY = (Cell.Y + 0.5f) * CellWorldSize - Dungeon->GridSize * 0.5f;
+	TestTrue(TEXT("The watched cell is beyond the unload radius of the dungeon's origin"), FVector2D(CellMaxX - CellWorldSize, CellCentreY - CellWorldSize * 0.5f).Size() > UnloadRadius);
+
+	// The viewer walks away from the cell's far side, so its distance to the cell is its distance from that side
+	auto MoveViewer = [Dungeon, DungeonLocation, CellMaxX, CellCentreY](const float DistanceFromCell)
+	{
+		Dungeon->UpdateStreaming({ DungeonLocation + FVector(CellMaxX + DistanceFromCell, CellCentreY, 0.0f) });
+	};
+
+	MoveViewer(1500.0f);
+	TestFalse(TEXT("A cell between the load and unload radii isn't loaded"), Dungeon->IsCellLoaded(Cell));
+	MoveViewer(900.0f);
+	TestTrue(TEXT("A cell within the load radius is loaded"), Dungeon->IsCellLoaded(Cell));
+	MoveViewer(1500.0f);
+	TestTrue(TEXT("A loaded cell between the load and unload radii stays loaded"), Dungeon->IsCellLoaded(Cell));
+
+	// Ticking would replace the simulated viewer with the dungeon's own location if streaming were updated automatically
+	Dungeon->Tick(1.0f);
+	TestTrue(TEXT("Ticking doesn't update streaming when it isn't automatic"), Dungeon->IsCellLoaded(Cell));
+
+	MoveViewer(2100.0f);
+	TestFalse(TEXT("A cell beyond the unload radius is unloaded"), Dungeon->IsCellLoaded(Cell));
+	MoveViewer(1500.0f);
+	TestFalse(TEXT("An unloaded cell between the load and unload radii stays unloaded"), Dungeon->IsCellLoaded(Cell));
+	MoveViewer(900.0f);
+	TestTrue(TEXT("A cell within the load radius is loaded again"), Dungeon->IsCellLoaded(Cell));
+
+	// A respawn streams around the last viewer rather than the players or the dungeon's origin
+	Dungeon->SpawnDungeon();
+	TestTrue(TEXT("A respawn keeps the cells near the simulated viewer loaded"), Dungeon->IsCellLoaded(Cell));
+
+	Dungeon->Destroy();
+	return true;
+}
+
+#endif
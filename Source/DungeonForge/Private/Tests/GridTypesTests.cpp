@@ -0,0 +1,367 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Layouts/GridCoordinateHelperLibrary.h"
+#include "Layouts/GridRectSet.h"
+#include "Layouts/GridTileBitmap.h"
+
+#include "Generators/SimpleGridDungeonGenerator.h"
+#include "Layouts/SimpleGridDungeonLayout.h"
+#include "Misc/AutomationTest.h"
+#include "Tests/ScopedAllocationCounter.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	/**
+	 * A coordinate hashed the way grid types were hashed before packed keys, by running a CRC over the struct. Used as the baseline in the hashing benchmark.
+	 */
+	struct FCrcHashedCoordinate
+	{
+		FGridCoordinate Coordinate;
+
+		bool operator==(const FCrcHashedCoordinate& Other) const { return Coordinate == Other.Coordinate; }
+	};
+
+	uint32 GetTypeHash(const FCrcHashedCoordinate& Key)
+	{
+		return FCrc::MemCrc32(&Key.Coordinate, sizeof(FGridCoordinate));
+	}
+
+	/**
+	 * @return The coordinates of a Width by Width square, with its centre at the origin.
+	 */
+	TArray<FGridCoordinate> MakeSquareOfCoordinates(const int32 Width)
+	{
+		TArray<FGridCoordinate> Coordinates;
+		Coordinates.Reserve(Width * Width);
+		for (int32 X = 0; X < Width; X++)
+		{
+			for (int32 Y = 0; Y < Width; Y++)
+			{
+				Coordinates.Emplace(X - Width / 2, Y - Width / 2);
+			}
+		}
+		return Coordinates;
+	}
+
+	bool DoRectsOverlap(const FRectBox& A, const FRectBox& B)
+	{
+		return A.BoxOrigin.X <= B.BoxBound.X && B.BoxOrigin.X <= A.BoxBound.X && A.BoxOrigin.Y <= B.BoxBound.Y && B.BoxOrigin.Y <= A.BoxBound.Y;
+	}
+
+	/**
+	 * Makes non-overlapping rectangles on both sides of zero. The first few span several 64 tile chunks, and the rest are random.
+	 */
+	TArray<FRectBox> MakeDisjointRects(const int32 Seed, const int32 NumRandomRects)
+	{
+		TArray<FRectBox> Rects = {
+			FRectBox(FGridCoordinate(-130, -10), FGridCoordinate(140, -4)),
+			FRectBox(FGridCoordinate(-70, 0), FGridCoordinate(-60, 200)),
+			FRectBox(FGridCoordinate(63, 63), FGridCoordinate(129, 129)),
+			FRectBox(FGridCoordinate(-200, -200), FGridCoordinate(-129, -65)) };
+
+		FRandomStream RandomStream(Seed);
+		for (int32 Attempt = 0; Attempt < NumRandomRects; Attempt++)
+		{
+			const FGridCoordinate Origin(RandomStream.RandRange(-250, 250), RandomStream.RandRange(-250, 250));
+			const FRectBox Rect(Origin, Origin + FGridCoordinate(RandomStream.RandRange(0, 40), RandomStream.RandRange(0, 40)));
+			if (!Rects.ContainsByPredicate([&Rect](const FRectBox& Other) { return DoRectsOverlap(Rect, Other); }))
+			{
+				Rects.Add(Rect);
+			}
+		}
+		return Rects;
+	}
+
+	/**
+	 * Adds every key to a set and then looks every key up again, returning the time taken in seconds.
+	 */
+	template <typename KeyType>
+	double TimeSetAddAndFind(const TArray<KeyType>& Keys, int32& OutNumFound)
+	{
+		const double StartTime = FPlatformTime::Seconds();
+		TSet<KeyType> Set;
+		Set.Reserve(Keys.Num());
+		for (const KeyType& Key : Keys)
+		{
+			Set.Add(Key);
+		}
+		OutNumFound = 0;
+		for (const KeyType& Key : Keys)
+		{
+			OutNumFound += Set.Contains(Key) ? 1 : 0;
+		}
+		return FPlatformTime::Seconds() - StartTime;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGridCoordinatePackedKeyTest, "DungeonForge.GridTypes.PackedKey", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FGridCoordinatePackedKeyTest::RunTest(const FString& Parameters)
+{
+	const FGridCoordinate Coordinates[] = { {0, 0}, {-1, 0}, {0, -1}, {1, 1}, {MIN_int32, MAX_int32}, {MAX_int32, MIN_int32} };
+	for (const FGridCoordinate& Coordinate : Coordinates)
+	{
+		TestTrue(TEXT("Packed keys round trip"), FGridCoordinate::FromPackedKey(Coordinate.GetPackedKey()) == Coordinate);
+	}
+
+	TestTrue(TEXT("Packed keys order by X first"), FGridCoordinate(-1, 5) < FGridCoordinate(0, -5));
+	TestTrue(TEXT("Packed keys order by Y within X"), FGridCoordinate(3, -2) < FGridCoordinate(3, 2));
+
+	const FGridEdge Edge(FGridCoordinate(2, 3), FGridCoordinate(2, 4));
+	const FGridEdge SwappedEdge(FGridCoordinate(2, 4), FGridCoordinate(2, 3));
+	TestTrue(TEXT("Edge hashes ignore coordinate order"), GetTypeHash(Edge) == GetTypeHash(SwappedEdge));
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGridCoordinateHashPerfTest, "DungeonForge.GridTypes.Perf.HashSetThroughput", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FGridCoordinateHashPerfTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 Width = 1000;
+	const TArray<FGridCoordinate> Coordinates = MakeSquareOfCoordinates(Width);
+
+	TArray<FCrcHashedCoordinate> CrcKeys;
+	CrcKeys.Reserve(Coordinates.Num());
+	for (const FGridCoordinate& Coordinate : Coordinates)
+	{
+		CrcKeys.Add({ Coordinate });
+	}
+
+	int32 NumFoundPacked = 0;
+	int32 NumFoundCrc = 0;
+	const double PackedSeconds = TimeSetAddAndFind(Coordinates, NumFoundPacked);
+	const double CrcSeconds = TimeSetAddAndFind(CrcKeys, NumFoundCrc);
+
+	TestEqual(TEXT("Every packed key is found"), NumFoundPacked, Coordinates.Num());
+	TestEqual(TEXT("Every CRC key is found"), NumFoundCrc, Coordinates.Num());
+
+	AddInfo(FString::Printf(TEXT("%d coordinates: packed key hash %.2f ms, CRC hash %.2f ms (%.2fx)"),
+		Coordinates.Num(), PackedSeconds * 1000.0, CrcSeconds * 1000.0, CrcSeconds / FMath::Max(PackedSeconds, UE_DOUBLE_SMALL_NUMBER)));
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGridTileBitmapContainsTest, "DungeonForge.GridTypes.TileBitmapContains", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FGridTileBitmapContainsTest::RunTest(const FString& Parameters)
+{
+	FRandomStream RandomStream(1234);
+	TSet<FGridCoordinate> Reference;
+	FGridTileBitmap Bitmap;
+	for (int32 i = 0; i < 5000; i++)
+	{
+		const FGridCoordinate Coordinate(RandomStream.RandRange(-300, 300), RandomStream.RandRange(-300, 300));
+		TestTrue(TEXT("Add reports whether the tile is new"), Bitmap.Add(Coordinate) != Reference.Contains(Coordinate));
+		Reference.Add(Coordinate);
+	}
+	TestEqual(TEXT("Bitmap holds as many tiles as the reference set"), Bitmap.Num(), Reference.Num());
+
+	int32 NumMismatches = 0;
+	for (int32 X = -310; X <= 310; X++)
+	{
+		for (int32 Y = -310; Y <= 310; Y++)
+		{
+			const FGridCoordinate Coordinate(X, Y);
+			NumMismatches += Bitmap.Contains(Coordinate) != Reference.Contains(Coordinate) ? 1 : 0;
+		}
+	}
+	TestEqual(TEXT("Bitmap and reference set agree on every tile"), NumMismatches, 0);
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGridRectSetQueriesTest, "DungeonForge.GridTypes.RectSetQueries", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FGridRectSetQueriesTest::RunTest(const FString& Parameters)
+{
+	const TArray<FRectBox> Rects = MakeDisjointRects(77, 200);
+	FGridRectSet RectSet;
+	RectSet.Append(Rects);
+
+	TMap<FGridCoordinate, int32> ReferenceRects;
+	for (int32 RectIndex = 0; RectIndex < Rects.Num(); RectIndex++)
+	{
+		for (const FGridCoordinate& Tile : Rects[RectIndex].GetFillCoordinates())
+		{
+			ReferenceRects.Add(Tile, RectIndex);
+		}
+	}
+	TestEqual(TEXT("Rect set counts every tile"), RectSet.Num(), ReferenceRects.Num());
+	TestEqual(TEXT("Rect set keeps every rectangle"), RectSet.GetRects().Num(), Rects.Num());
+
+	int32 NumContainsMismatches = 0;
+	int32 NumFindMismatches = 0;
+	for (int32 X = -300; X <= 300; X++)
+	{
+		for (int32 Y = -300; Y <= 300; Y++)
+		{
+			const FGridCoordinate Coordinate(X, Y);
+			const int32* ReferenceRect = ReferenceRects.Find(Coordinate);
+			NumContainsMismatches += RectSet.Contains(Coordinate) != (ReferenceRect != nullptr) ? 1 : 0;
+
+			const FRectBox* FoundRect = RectSet.FindRect(Coordinate);
+			const bool bFoundMatches = ReferenceRect
+				? FoundRect && FoundRect->BoxOrigin == Rects[*ReferenceRect].BoxOrigin && FoundRect->BoxBound == Rects[*ReferenceRect].BoxBound
+				: FoundRect == nullptr;
+			NumFindMismatches += bFoundMatches ? 0 : 1;
+		}
+	}
+	TestEqual(TEXT("Rect set and reference agree on every tile"), NumContainsMismatches, 0);
+	TestEqual(TEXT("Rect set finds the rectangle holding every tile"), NumFindMismatches, 0);
+
+	int32 NumVisited = 0;
+	bool bVisitsOnlyRectTiles = true;
+	RectSet.ForEach([&](const FGridCoordinate& Tile)
+	{
+		NumVisited++;
+		bVisitsOnlyRectTiles &= ReferenceRects.Contains(Tile);
+	});
+	TestEqual(TEXT("ForEach visits every tile once"), NumVisited, ReferenceRects.Num());
+	TestTrue(TEXT("ForEach only visits tiles of the rectangles"), bVisitsOnlyRectTiles);
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGridTileBitmapPerfTest, "DungeonForge.GridTypes.Perf.TileBitmapMemoryAndQueries", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FGridTileBitmapPerfTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 Width = 512;
+	const TArray<FGridCoordinate> Coordinates = MakeSquareOfCoordinates(Width);
+
+	FGridTileBitmap Bitmap;
+	Bitmap.Append(Coordinates);
+	TSet<FGridCoordinate> Set(Coordinates);
+
+	TestEqual(TEXT("Bitmap holds every tile"), Bitmap.Num(), Coordinates.Num());
+
+	// Query a window twice the width of the filled square, so half of the lookups miss.
+	int32 NumFoundBitmap = 0;
+	double StartTime = FPlatformTime::Seconds();
+	for (int32 X = -Width; X < Width; X++)
+	{
+		for (int32 Y = -Width; Y < Width; Y++)
+		{
+			NumFoundBitmap += Bitmap.Contains(FGridCoordinate(X, Y)) ? 1 : 0;
+		}
+	}
+	const double BitmapSeconds = FPlatformTime::Seconds() - StartTime;
+
+	int32 NumFoundSet = 0;
+	StartTime = FPlatformTime::Seconds();
+	for (int32 X = -Width; X < Width; X++)
+	{
+		for (int32 Y = -Width; Y < Width; Y++)
+		{
+			NumFoundSet += Set.Contains(FGridCoordinate(X, Y)) ? 1 : 0;
+		}
+	}
+	const double SetSeconds = FPlatformTime::Seconds() - StartTime;
+
+	TestEqual(TEXT("Bitmap and set find the same tiles"), NumFoundBitmap, NumFoundSet);
+
+	const int32 NumQueries = 4 * Width * Width;
+	AddInfo(FString::Printf(TEXT("%d tiles: bitmap %.3f bytes/tile, TSet %.3f bytes/tile"),
+		Coordinates.Num(), static_cast<double>(Bitmap.GetAllocatedSize()) / Coordinates.Num(), static_cast<double>(Set.GetAllocatedSize()) / Coordinates.Num()));
+	AddInfo(FString::Printf(TEXT("%d lookups: bitmap %.1f Mq/s, TSet %.1f Mq/s"),
+		NumQueries, NumQueries / FMath::Max(BitmapSeconds, UE_DOUBLE_SMALL_NUMBER) / 1e6, NumQueries / FMath::Max(SetSeconds, UE_DOUBLE_SMALL_NUMBER) / 1e6));
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FAdjacentCoordinateOrderTest, "DungeonForge.GridTypes.AdjacentCoordinateOrder", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FAdjacentCoordinateOrderTest::RunTest(const FString& Parameters)
+{
+	const FGridCoordinate Coordinate(7, -3);
+	for (const bool bIncludeDiagonal : { false, true })
+	{
+		for (int32 Direction = 0; Direction <= 4; Direction++)
+		{
+			TArray<FGridCoordinate> Visited;
+			UGridCoordinateHelperLibrary::ForEachAdjacentCoordinate(Coordinate, [&Visited](const FGridCoordinate& Neighbour) { Visited.Add(Neighbour); }, bIncludeDiagonal, Direction);
+			TestTrue(FString::Printf(TEXT("Visits the same neighbours as GetAdjacentCoordinates (diagonal %d, direction %d)"), bIncludeDiagonal, Direction),
+				Visited == UGridCoordinateHelperLibrary::GetAdjacentCoordinates(Coordinate, bIncludeDiagonal, Direction));
+		}
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FAdjacentCoordinatePerfTest, "DungeonForge.GridTypes.Perf.AdjacentCoordinates", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FAdjacentCoordinatePerfTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumRooms = 500;
+	USimpleGridDungeonGenerator* Generator = NewObject<USimpleGridDungeonGenerator>();
+	Generator->SetNumRooms(NumRooms);
+
+	// The first generation builds the shape catalogue and sizes the scratch, which later generations reuse
+	FSimpleGridGenerationScratch Scratch;
+	FSimpleGridLayoutData Layout;
+	Generator->GenerateLayoutData(0, Scratch, Layout);
+
+	int64 GenerationAllocations = 0;
+	double StartTime = FPlatformTime::Seconds();
+	{
+		FScopedAllocationCounter AllocationCounter;
+		Generator->GenerateLayoutData(1, Scratch, Layout);
+		GenerationAllocations = AllocationCounter.GetNumAllocations();
+	}
+	const double GenerationSeconds = FPlatformTime::Seconds() - StartTime;
+
+	TSet<FGridCoordinate> RoomTiles(Layout.RoomTiles);
+	for (const FRectBox& Rect : Layout.RoomRects)
+	{
+		RoomTiles.Append(Rect.GetFillCoordinates());
+	}
+
+	// Replay the per-tile wall search generation used to run over every room tile, first with a neighbour array per tile as before
+	int32 NumWallsArray = 0;
+	int64 ArrayAllocations = 0;
+	StartTime = FPlatformTime::Seconds();
+	{
+		FScopedAllocationCounter AllocationCounter;
+		for (const FGridCoordinate& Coordinate : RoomTiles)
+		{
+			for (const FGridCoordinate& Neighbour : UGridCoordinateHelperLibrary::GetAdjacentCoordinates(Coordinate))
+			{
+				NumWallsArray += RoomTiles.Contains(Neighbour) ? 0 : 1;
+			}
+		}
+		ArrayAllocations = AllocationCounter.GetNumAllocations();
+	}
+	const double ArraySeconds = FPlatformTime::Seconds() - StartTime;
+
+	int32 NumWallsVisitor = 0;
+	int64 VisitorAllocations = 0;
+	StartTime = FPlatformTime::Seconds();
+	{
+		FScopedAllocationCounter AllocationCounter;
+		for (const FGridCoordinate& Coordinate : RoomTiles)
+		{
+			UGridCoordinateHelperLibrary::ForEachAdjacentCoordinate(Coordinate, [&RoomTiles, &NumWallsVisitor](const FGridCoordinate& Neighbour)
+			{
+				NumWallsVisitor += RoomTiles.Contains(Neighbour) ? 0 : 1;
+			});
+		}
+		VisitorAllocations = AllocationCounter.GetNumAllocations();
+	}
+	const double VisitorSeconds = FPlatformTime::Seconds() - StartTime;
+
+	TestEqual(TEXT("Both searches find the same walls"), NumWallsVisitor, NumWallsArray);
+	TestTrue(TEXT("The neighbour visitor doesn't allocate"), VisitorAllocations == 0);
+
+	AddInfo(FString::Printf(TEXT("%d room generation: %.2f ms, %.2f allocations per room"),
+		NumRooms, GenerationSeconds * 1000.0, static_cast<double>(GenerationAllocations) / NumRooms));
+	AddInfo(FString::Printf(TEXT("Wall search over its %d room tiles: GetAdjacentCoordinates %.2f ms, %.2f allocations per room; ForEachAdjacentCoordinate %.2f ms, %.2f allocations per room"),
+		RoomTiles.Num(), ArraySeconds * 1000.0, static_cast<double>(ArrayAllocations) / NumRooms, VisitorSeconds * 1000.0, static_cast<double>(VisitorAllocations) / NumRooms));
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,149 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Generators/RoomOffsetCacheSubsystem.h"
+
+#include "Misc/AutomationTest.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	/**
+	 * Shapes for the offset tests: a single tile, a rectangle, an L, and a shape whose tiles don't include its origin.
+	 */
+	TArray<TArray<FGridCoordinate>> MakeTestShapes()
+	{
+		TArray<TArray<FGridCoordinate>> Shapes;
+		Shapes.Add({ FGridCoordinate(0, 0) });
+		Shapes.Add(FRectBox(FGridCoordinate(0, 0), FGridCoordinate(1, 2)).GetFillCoordinates());
+		Shapes.Add({ FGridCoordinate(0, 0), FGridCoordinate(1, 0), FGridCoordinate(2, 0), FGridCoordinate(0, 1), FGridCoordinate(0, 2) });
+		Shapes.Add({ FGridCoordinate(2, 2), FGridCoordinate(3, 2), FGridCoordinate(3, 3) });
+		for (TArray<FGridCoordinate>& Shape : Shapes)
+		{
+			Shape.Sort();
+		}
+		return Shapes;
+	}
+
+	FDungeonRoom MakeRoom(const FGridCoordinate& Origin, TConstArrayView<FGridCoordinate> Tiles)
+	{
+		return FDungeonRoom(Origin, TSet<FGridCoordinate>(Tiles));
+	}
+
+	/**
+	 * Gets the bounding box of a shape's tiles.
+	 */
+	void GetShapeBounds(TConstArrayView<FGridCoordinate> Tiles, FGridCoordinate& OutMin, FGridCoordinate& OutMax)
+	{
+		OutMin = FGridCoordinate(MAX_int32, MAX_int32);
+		OutMax = FGridCoordinate(MIN_int32, MIN_int32);
+		for (const FGridCoordinate& Tile : Tiles)
+		{
+			OutMin = FGridCoordinate(FMath::Min(OutMin.X, Tile.X), FMath::Min(OutMin.Y, Tile.Y));
+			OutMax = FGridCoordinate(FMath::Max(OutMax.X, Tile.X), FMath::Max(OutMax.Y, Tile.Y));
+		}
+	}
+
+	/**
+	 * Finds the touching and blocked offsets of B from A by trying B at every offset near A with the room overlap and touch tests.
+	 */
+	void BruteForcePairOffsets(TConstArrayView<FGridCoordinate> RoomA, TConstArrayView<FGridCoordinate> RoomB, TArray<FGridCoordinate>& OutTouching, TArray<FGridCoordinate>& OutBlocked)
+	{
+		FGridCoordinate MinA, MaxA, MinB, MaxB;
+		GetShapeBounds(RoomA, MinA, MaxA);
+		GetShapeBounds(RoomB, MinB, MaxB);
+
+		const FDungeonRoom PlacedA = MakeRoom(FGridCoordinate(0, 0), RoomA);
+		const TSet<FGridCoordinate> ATiles(RoomA);
+		for (int32 X = FMath::Min(MinA.X, MinA.X - MaxB.X) - 1; X <= FMath::Max(MaxA.X, MaxA.X - MinB.X) + 1; X++)
+		{
+			for (int32 Y = FMath::Min(MinA.Y, MinA.Y - MaxB.Y) - 1; Y <= FMath::Max(MaxA.Y, MaxA.Y - MinB.Y) + 1; Y++)
+			{
+				const FGridCoordinate Offset(X, Y);
+				const FDungeonRoom PlacedB = MakeRoom(Offset, RoomB);
+				const bool bOriginInsideA = ATiles.Contains(Offset);
+				if (FDungeonRoom::DoRoomsOverlap(PlacedA, PlacedB) || bOriginInsideA)
+				{
+					OutBlocked.Add(Offset);
+				}
+				else if (FDungeonRoom::AreRoomsTouching(PlacedA, PlacedB))
+				{
+					OutTouching.Add(Offset);
+				}
+			}
+		}
+		OutTouching.Sort();
+		OutBlocked.Sort();
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRoomPairOffsetsTest, "DungeonForge.RoomOffsetCache.PairOffsetsMatchBruteForce", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FRoomPairOffsetsTest::RunTest(const FString& Parameters)
+{
+	const TSharedRef<FRoomShapeCatalogue> Catalogue = FRoomShapeCatalogue::Build(MakeTestShapes());
+
+	for (int32 ShapeA = 0; ShapeA < Catalogue->NumShapes(); ShapeA++)
+	{
+		for (int32 ShapeB = 0; ShapeB < Catalogue->NumShapes(); ShapeB++)
+		{
+			TArray<FGridCoordinate> ExpectedTouching;
+			TArray<FGridCoordinate> ExpectedBlocked;
+			BruteForcePairOffsets(Catalogue->GetShapeTiles(ShapeA), Catalogue->GetShapeTiles(ShapeB), ExpectedTouching, ExpectedBlocked);
+
+			TestTrue(FString::Printf(TEXT("Pair offsets of shapes %d and %d match the brute force search"), ShapeA, ShapeB),
+				TArray<FGridCoordinate>(Catalogue->GetPairOffsets(ShapeA, ShapeB)) == ExpectedTouching);
+			TestTrue(FString::Printf(TEXT("Blocked offsets of shapes %d and %d match the brute force search"), ShapeA, ShapeB),
+				TArray<FGridCoordinate>(Catalogue->GetBlockedOffsets(ShapeA, ShapeB)) == ExpectedBlocked);
+		}
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRoomCatalogueSerializeTest, "DungeonForge.RoomOffsetCache.SerializeRebuildsInvalidTables", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FRoomCatalogueSerializeTest::RunTest(const FString& Parameters)
+{
+	const TSharedRef<FRoomShapeCatalogue> Built = FRoomShapeCatalogue::Build(MakeTestShapes());
+
+	// A catalogue saved as built loads back with the same tables
+	{
+		TArray<uint8> Bytes;
+		FMemoryWriter Writer(Bytes);
+		Built->Serialize(Writer);
+
+		FRoomShapeCatalogue Loaded;
+		FMemoryReader Reader(Bytes);
+		Loaded.Serialize(Reader);
+		TestFalse(TEXT("Catalogue loads without error"), Reader.IsError());
+		TestTrue(TEXT("Loaded pair offsets match"), Loaded.PairOffsets == Built->PairOffsets && Loaded.PairOffsetStarts == Built->PairOffsetStarts);
+		TestTrue(TEXT("Loaded blocked offsets match"), Loaded.BlockedOffsets == Built->BlockedOffsets && Loaded.BlockedOffsetStarts == Built->BlockedOffsetStarts);
+		TestTrue(TEXT("Loaded door candidates match"), Loaded.DoorCandidates == Built->DoorCandidates);
+	}
+
+	// Starts which don't describe the offsets are thrown away and rebuilt from the shapes
+	FRoomShapeCatalogue Corrupt = *Built;
+	Corrupt.PairOffsetStarts.Last() += 100;
+	Corrupt.BlockedOffsetStarts.Pop();
+	{
+		TArray<uint8> Bytes;
+		FMemoryWriter Writer(Bytes);
+		Corrupt.Serialize(Writer);
+
+		FRoomShapeCatalogue Loaded;
+		FMemoryReader Reader(Bytes);
+		AddExpectedError(TEXT("Rebuilding the invalid pair offset tables"), EAutomationExpectedErrorFlags::Contains, 1);
+		Loaded.Serialize(Reader);
+		TestFalse(TEXT("Corrupt catalogue loads without error"), Reader.IsError());
+		TestTrue(TEXT("Rebuilt pair offsets match"), Loaded.PairOffsets == Built->PairOffsets && Loaded.PairOffsetStarts == Built->PairOffsetStarts);
+		TestTrue(TEXT("Rebuilt blocked offsets match"), Loaded.BlockedOffsets == Built->BlockedOffsets && Loaded.BlockedOffsetStarts == Built->BlockedOffsetStarts);
+	}
+
+	return true;
+}
+
+#endif
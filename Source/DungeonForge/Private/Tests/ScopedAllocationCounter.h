@@ -0,0 +1,93 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/**
+ * Counts the heap allocations made on the constructing thread while it is in scope, for the allocation benchmarks.
+ * GMalloc is swapped for a forwarding allocator until the counter is destroyed, so other threads keep working but aren't counted.
+ * Not reentrant: only one counter may be alive at a time.
+ */
+class FScopedAllocationCounter
+{
+public:
+	FScopedAllocationCounter()
+	{
+		check(IsInGameThread());
+		FCountingMalloc& CountingMalloc = GetCountingMalloc();
+		check(GMalloc != &CountingMalloc);
+		CountingMalloc.Inner = GMalloc;
+		CountingMalloc.CountedThreadId = FPlatformTLS::GetCurrentThreadId();
+		CountingMalloc.NumAllocations = 0;
+		GMalloc = &CountingMalloc;
+	}
+
+	~FScopedAllocationCounter()
+	{
+		// Other threads may still be inside the forwarding allocator, so it stays alive and keeps forwarding after this
+		GMalloc = GetCountingMalloc().Inner;
+	}
+
+	/**
+	 * @return The number of Malloc calls, and Realloc calls which grow or create a block, made on this thread so far.
+	 */
+	int64 GetNumAllocations() const
+	{
+		return GetCountingMalloc().NumAllocations;
+	}
+
+private:
+	class FCountingMalloc final : public FMalloc
+	{
+	public:
+		FMalloc* Inner = nullptr;
+		uint32 CountedThreadId = 0;
+		int64 NumAllocations = 0;
+
+		virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+		{
+			CountAllocation();
+			return Inner->Malloc(Count, Alignment);
+		}
+
+		virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+		{
+			if (Count > 0)
+			{
+				CountAllocation();
+			}
+			return Inner->Realloc(Original, Count, Alignment);
+		}
+
+		virtual void Free(void* Original) override
+		{
+			Inner->Free(Original);
+		}
+
+		virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+		virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+		virtual void Trim(bool bTrimThreadCaches) override { Inner->Trim(bTrimThreadCaches); }
+		virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+		virtual const TCHAR* GetDescriptiveName() override { return TEXT("ScopedAllocationCounter"); }
+
+	private:
+		void CountAllocation()
+		{
+			if (FPlatformTLS::GetCurrentThreadId() == CountedThreadId)
+			{
+				NumAllocations++;
+			}
+		}
+	};
+
+	static FCountingMalloc& GetCountingMalloc()
+	{
+		static FCountingMalloc CountingMalloc;
+		return CountingMalloc;
+	}
+};
+
+#endif
@@ -0,0 +1,412 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Generators/SimpleGridDungeonGenerator.h"
+
+#include "Algo/BinarySearch.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Generators/RoomOffsetCacheSubsystem.h"
+#include "Layouts/GridTileBitmap.h"
+#include "Layouts/SimpleGridDungeonLayout.h"
+#include "Misc/AutomationTest.h"
+#include "Tests/ScopedAllocationCounter.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	bool AreRectsEqual(const TArray<FRectBox>& A, const TArray<FRectBox>& B)
+	{
+		if (A.Num() != B.Num()) return false;
+		for (int32 i = 0; i < A.Num(); i++)
+		{
+			if (A[i].BoxOrigin != B[i].BoxOrigin || A[i].BoxBound != B[i].BoxBound) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @return True if both layouts hold the same tiles, rectangles, walls and doors, in the same order.
+	 */
+	bool AreLayoutsEqual(const FSimpleGridLayoutData& A, const FSimpleGridLayoutData& B)
+	{
+		return A.Seed == B.Seed
+			&& A.RoomTiles == B.RoomTiles
+			&& A.CorridorTiles == B.CorridorTiles
+			&& AreRectsEqual(A.RoomRects, B.RoomRects)
+			&& AreRectsEqual(A.CorridorRects, B.CorridorRects)
+			&& A.Walls == B.Walls
+			&& A.Doors == B.Doors
+			&& A.bImputesWallPositions == B.bImputesWallPositions;
+	}
+
+	USimpleGridDungeonGenerator* MakeGenerator(const int32 NumRooms)
+	{
+		USimpleGridDungeonGenerator* Generator = NewObject<USimpleGridDungeonGenerator>();
+		Generator->SetNumRooms(NumRooms);
+		return Generator;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FShapeOverlapPerfTest, "DungeonForge.SimpleGridGenerator.Perf.ShapeOverlap", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FShapeOverlapPerfTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumRooms = 500;
+	const USimpleGridDungeonGenerator* Generator = MakeGenerator(NumRooms);
+	const FRoomShapeCatalogue& Catalogue = *Generator->GetCatalogue();
+
+	// The second generation reuses the scratch, so it times placement rather than the first allocations
+	FSimpleGridGenerationScratch Scratch;
+	FSimpleGridLayoutData Layout;
+	Generator->GenerateLayoutData(0, Scratch, Layout);
+	double StartTime = FPlatformTime::Seconds();
+	Generator->GenerateLayoutData(0, Scratch, Layout);
+	const double GenerationSeconds = FPlatformTime::Seconds() - StartTime;
+
+	// Replay the generation's placements, and after each one make the overlap tests PlaceRoom makes for every shape's new candidates,
+	// both against the bitmap and against a set of tiles the way CanPlaceShape tested them before footprints
+	struct FQuery
+	{
+		int32 ShapeId;
+		FGridCoordinate Origin;
+	};
+	TArray<FQuery> Queries;
+	FGridTileBitmap UsedBitmap;
+	TSet<FGridCoordinate> UsedSet;
+	int32 NumQueries = 0;
+	int32 NumPlaceableSet = 0;
+	int32 NumPlaceableBitmap = 0;
+	int64 BitmapAllocations = 0;
+	double SetSeconds = 0.0;
+	double BitmapSeconds = 0.0;
+	for (const FPlacedRoom& Room : Scratch.RoomLayout)
+	{
+		for (const FGridCoordinate& Tile : Catalogue.GetShapeTiles(Room.ShapeId))
+		{
+			UsedBitmap.Add(Tile + Room.Origin);
+			UsedSet.Add(Tile + Room.Origin);
+		}
+
+		Queries.Reset();
+		for (const int32 ShapeId : Scratch.PossibleShapeIds)
+		{
+			for (const FGridCoordinate& Offset : Catalogue.GetPairOffsets(Room.ShapeId, ShapeId))
+			{
+				Queries.Add({ ShapeId, Room.Origin + Offset });
+			}
+		}
+		NumQueries += Queries.Num();
+
+		StartTime = FPlatformTime::Seconds();
+		for (const FQuery& Query : Queries)
+		{
+			if (UsedSet.Contains(Query.Origin)) continue;
+			bool bOverlaps = false;
+			for (const FGridCoordinate& Tile : Catalogue.GetShapeTiles(Query.ShapeId))
+			{
+				if (UsedSet.Contains(Tile + Query.Origin))
+				{
+					bOverlaps = true;
+					break;
+				}
+			}
+			NumPlaceableSet += bOverlaps ? 0 : 1;
+		}
+		SetSeconds += FPlatformTime::Seconds() - StartTime;
+
+		StartTime = FPlatformTime::Seconds();
+		{
+			FScopedAllocationCounter AllocationCounter;
+			for (const FQuery& Query : Queries)
+			{
+				if (UsedBitmap.Contains(Query.Origin)) continue;
+				const FRoomShapeCatalogue::FShapeFootprint& Footprint = Catalogue.GetFootprint(Query.ShapeId);
+				NumPlaceableBitmap += UsedBitmap.IntersectsRows(Footprint.RowMasks, Query.Origin + Footprint.BottomLeft) ? 0 : 1;
+			}
+			BitmapAllocations += AllocationCounter.GetNumAllocations();
+		}
+		BitmapSeconds += FPlatformTime::Seconds() - StartTime;
+	}
+
+	TestEqual(TEXT("Footprint and per-tile tests agree on every placement"), NumPlaceableBitmap, NumPlaceableSet);
+	TestTrue(TEXT("Footprint tests don't allocate"), BitmapAllocations == 0);
+
+	constexpr double TargetSpeedup = 20.0;
+	const double Speedup = SetSeconds / FMath::Max(BitmapSeconds, UE_DOUBLE_SMALL_NUMBER);
+	AddInfo(FString::Printf(TEXT("%d room generation in %.2f ms made %d overlap tests (%d placeable): per-tile TSet %.2f ms, row mask footprint %.2f ms with %lld allocations (%.1fx, target %.0fx)"),
+		Scratch.RoomLayout.Num(), GenerationSeconds * 1000.0, NumQueries, NumPlaceableBitmap, SetSeconds * 1000.0, BitmapSeconds * 1000.0, BitmapAllocations, Speedup, TargetSpeedup));
+	if (Speedup < TargetSpeedup)
+	{
+		AddWarning(FString::Printf(TEXT("Footprint overlap tests are %.1fx faster than per-tile lookups, short of the %.0fx target"), Speedup, TargetSpeedup));
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSimpleGridTemplatesTest, "DungeonForge.SimpleGridGenerator.TemplatesMatchTileSearch", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FSimpleGridTemplatesTest::RunTest(const FString& Parameters)
+{
+	const USimpleGridDungeonGenerator* Generator = MakeGenerator(200);
+	const FRoomShapeCatalogue& Catalogue = *Generator->GetCatalogue();
+	FSimpleGridGenerationScratch Scratch;
+
+	for (int32 Seed = 0; Seed < 8; Seed++)
+	{
+		FSimpleGridLayoutData Layout;
+		Generator->GenerateLayoutData(Seed, Scratch, Layout);
+
+		// Each room's walls, found the way generation did before templates: every neighbour of a room tile outside the room
+		bool bWallsMatch = true;
+		int32 WallIndex = 0;
+		for (const FPlacedRoom& Room : Scratch.RoomLayout)
+		{
+			const TConstArrayView<FGridCoordinate> ShapeTiles = Catalogue.GetShapeTiles(Room.ShapeId);
+			TSet<FGridEdge> RoomWalls;
+			for (const FGridCoordinate& Coord : ShapeTiles)
+			{
+				UGridCoordinateHelperLibrary::ForEachAdjacentCoordinate(Coord, [&](const FGridCoordinate& AdjacentCoord)
+				{
+					if (Algo::BinarySearch(ShapeTiles, AdjacentCoord) != INDEX_NONE) return;
+					RoomWalls.Add({AdjacentCoord+Room.Origin, Coord+Room.Origin});
+				});
+			}
+
+			// The templates emit each room's walls together, once each
+			const int32 NumRoomWalls = RoomWalls.Num();
+			bWallsMatch &= WallIndex + NumRoomWalls <= Layout.Walls.Num()
+				&& TSet<FGridEdge>(MakeArrayView(Layout.Walls.GetData() + WallIndex, NumRoomWalls)).Includes(RoomWalls);
+			WallIndex += NumRoomWalls;
+		}
+		bWallsMatch &= WallIndex == Layout.Walls.Num();
+		TestTrue(FString::Printf(TEXT("Seed %d: template walls match the per-tile search"), Seed), bWallsMatch);
+
+		// Each connection's door candidates, found the way generation did before templates: a door from every tile of the new room
+		// touching its parent, to the last parent tile it touches
+		bool bDoorCandidatesMatch = Layout.Doors.Num() == Scratch.RoomConnections.Num();
+		bool bDoorsAreCandidates = bDoorCandidatesMatch;
+		for (int32 ConnectionIndex = 0; bDoorCandidatesMatch && ConnectionIndex < Scratch.RoomConnections.Num(); ConnectionIndex++)
+		{
+			const FRoomConnection& Connection = Scratch.RoomConnections[ConnectionIndex];
+			const FPlacedRoom& NewRoom = Scratch.RoomLayout[Connection.RoomIndex];
+			const FPlacedRoom& OtherRoom = Scratch.RoomLayout[Connection.ParentRoomIndex];
+			const TConstArrayView<FGridCoordinate> OtherRoomTiles = Catalogue.GetShapeTiles(OtherRoom.ShapeId);
+
+			TMap<FGridCoordinate, FGridCoordinate> PotentialDoorTiles;
+			for (const FGridCoordinate& LocalCoord : Catalogue.GetShapeTiles(NewRoom.ShapeId))
+			{
+				const FGridCoordinate Coord = LocalCoord+NewRoom.Origin;
+				UGridCoordinateHelperLibrary::ForEachAdjacentCoordinate(Coord, [&](const FGridCoordinate& AdjacentCoord)
+				{
+					if (Algo::BinarySearch(OtherRoomTiles, AdjacentCoord+OtherRoom.Origin.Inverse()) != INDEX_NONE)
+					{
+						PotentialDoorTiles.Add(Coord, AdjacentCoord);
+					}
+				});
+			}
+
+			// The candidates must come in the same order too, so the same random index picks the same door
+			const TConstArrayView<FGridEdge> DoorCandidates = Catalogue.GetDoorCandidates(Connection.PairOffsetIndex);
+			bDoorCandidatesMatch &= DoorCandidates.Num() == PotentialDoorTiles.Num();
+			int32 CandidateIndex = 0;
+			bool bDoorIsCandidate = false;
+			for (const TPair<FGridCoordinate, FGridCoordinate>& DoorTile : PotentialDoorTiles)
+			{
+				const FGridEdge ExpectedDoor(DoorTile.Key, DoorTile.Value);
+				if (CandidateIndex < DoorCandidates.Num())
+				{
+					const FGridEdge& Candidate = DoorCandidates[CandidateIndex++];
+					bDoorCandidatesMatch &= FGridEdge(Candidate.CoordinateA+OtherRoom.Origin, Candidate.CoordinateB+OtherRoom.Origin) == ExpectedDoor;
+				}
+				bDoorIsCandidate |= Layout.Doors[ConnectionIndex] == ExpectedDoor;
+			}
+			bDoorsAreCandidates &= bDoorIsCandidate;
+		}
+		TestTrue(FString::Printf(TEXT("Seed %d: template door candidates match the per-tile search"), Seed), bDoorCandidatesMatch);
+		TestTrue(FString::Printf(TEXT("Seed %d: every door is one of its connection's candidates"), Seed), bDoorsAreCandidates);
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSimpleGridParallelPlacementTest, "DungeonForge.SimpleGridGenerator.ParallelPlacementMatchesSerial", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FSimpleGridParallelPlacementTest::RunTest(const FString& Parameters)
+{
+	for (const int32 NumRooms : { 10, 100, 400 })
+	{
+		const USimpleGridDungeonGenerator* Generator = MakeGenerator(NumRooms);
+		FSimpleGridGenerationScratch SerialScratch;
+
+		// Different worker caps split the candidates at different points, which mustn't change the merged order
+		for (const int32 MaxPlacementWorkers : { 0, 2, 3 })
+		{
+			FSimpleGridGenerationScratch ParallelScratch;
+			ParallelScratch.bParallelPlacement = true;
+			ParallelScratch.MaxPlacementWorkers = MaxPlacementWorkers;
+
+			for (int32 Seed = 0; Seed < 8; Seed++)
+			{
+				FSimpleGridLayoutData SerialLayout;
+				FSimpleGridLayoutData ParallelLayout;
+				Generator->GenerateLayoutData(Seed, SerialScratch, SerialLayout);
+				Generator->GenerateLayoutData(Seed, ParallelScratch, ParallelLayout);
+				TestTrue(FString::Printf(TEXT("Parallel placement matches serial placement (%d rooms, %d workers, seed %d)"), NumRooms, MaxPlacementWorkers, Seed),
+					AreLayoutsEqual(SerialLayout, ParallelLayout));
+			}
+		}
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSimpleGridParallelPlacementPerfTest, "DungeonForge.SimpleGridGenerator.Perf.ParallelPlacementScaling", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FSimpleGridParallelPlacementPerfTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumRooms = 2000;
+	constexpr int32 NumSeeds = 4;
+	const USimpleGridDungeonGenerator* Generator = MakeGenerator(NumRooms);
+
+	// Each configuration generates every seed once to size its scratch, then again for timing
+	const auto TimeLayouts = [Generator](FSimpleGridGenerationScratch& Scratch, TArray<FSimpleGridLayoutData>& OutLayouts)
+	{
+		OutLayouts.SetNum(NumSeeds);
+		for (int32 Seed = 0; Seed < NumSeeds; Seed++)
+		{
+			Generator->GenerateLayoutData(Seed, Scratch, OutLayouts[Seed]);
+		}
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Seed = 0; Seed < NumSeeds; Seed++)
+		{
+			Generator->GenerateLayoutData(Seed, Scratch, OutLayouts[Seed]);
+		}
+		return (FPlatformTime::Seconds() - StartTime) / NumSeeds;
+	};
+
+	FSimpleGridGenerationScratch SerialScratch;
+	TArray<FSimpleGridLayoutData> SerialLayouts;
+	const double SerialSeconds = TimeLayouts(SerialScratch, SerialLayouts);
+	AddInfo(FString::Printf(TEXT("%d rooms, serial placement: %.2f ms per layout"), NumRooms, SerialSeconds * 1000.0));
+
+	const int32 NumThreads = FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+	for (const int32 MaxPlacementWorkers : { 1, 2, 4, 8, NumThreads })
+	{
+		FSimpleGridGenerationScratch Scratch;
+		Scratch.bParallelPlacement = true;
+		Scratch.MaxPlacementWorkers = MaxPlacementWorkers;
+		TArray<FSimpleGridLayoutData> Layouts;
+		const double Seconds = TimeLayouts(Scratch, Layouts);
+
+		bool bMatchesSerial = true;
+		for (int32 Seed = 0; Seed < NumSeeds; Seed++)
+		{
+			bMatchesSerial &= AreLayoutsEqual(SerialLayouts[Seed], Layouts[Seed]);
+		}
+		TestTrue(FString::Printf(TEXT("Placement on %d workers matches serial placement"), MaxPlacementWorkers), bMatchesSerial);
+
+		AddInfo(FString::Printf(TEXT("%d rooms, placement on up to %d workers: %.2f ms per layout (%.2fx serial)"),
+			NumRooms, MaxPlacementWorkers, Seconds * 1000.0, SerialSeconds / FMath::Max(Seconds, UE_DOUBLE_SMALL_NUMBER)));
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSimpleGridSeedDeterminismTest, "DungeonForge.SimpleGridGenerator.SameSeedSameLayout", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FSimpleGridSeedDeterminismTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumRooms = 150;
+	const USimpleGridDungeonGenerator* Generator = MakeGenerator(NumRooms);
+	const USimpleGridDungeonGenerator* OtherGenerator = MakeGenerator(NumRooms);
+
+	// A scratch that has already been used for other seeds must not leak state into the next generation
+	FSimpleGridGenerationScratch ReusedScratch;
+	for (const int32 Seed : { 7, -3, 123456 })
+	{
+		FSimpleGridGenerationScratch FreshScratch;
+		FSimpleGridLayoutData FirstLayout;
+		Generator->GenerateLayoutData(Seed, FreshScratch, FirstLayout);
+
+		for (int32 Run = 0; Run < 3; Run++)
+		{
+			FSimpleGridLayoutData Layout;
+			Generator->GenerateLayoutData(Seed, ReusedScratch, Layout);
+			TestTrue(FString::Printf(TEXT("Seed %d generates the same layout on run %d"), Seed, Run), AreLayoutsEqual(FirstLayout, Layout));
+		}
+
+		FSimpleGridLayoutData OtherGeneratorLayout;
+		OtherGenerator->GenerateLayoutData(Seed, ReusedScratch, OtherGeneratorLayout);
+		TestTrue(FString::Printf(TEXT("Seed %d generates the same layout on another generator"), Seed), AreLayoutsEqual(FirstLayout, OtherGeneratorLayout));
+
+		FSimpleGridLayoutData NextSeedLayout;
+		Generator->GenerateLayoutData(Seed + 1, ReusedScratch, NextSeedLayout);
+		TestFalse(FString::Printf(TEXT("Seeds %d and %d generate different rooms"), Seed, Seed + 1), FirstLayout.RoomTiles == NextSeedLayout.RoomTiles);
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSimpleGridBatchTest, "DungeonForge.SimpleGridGenerator.BatchMatchesSingleLayouts", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FSimpleGridBatchTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 FirstSeed = 1000;
+	constexpr int32 NumLayouts = 32;
+	const USimpleGridDungeonGenerator* Generator = MakeGenerator(60);
+
+	// Fewer workers than layouts means each worker's scratch is reused across layouts
+	for (const int32 MaxWorkers : { 0, 3 })
+	{
+		const TArray<FSimpleGridLayoutData> Batch = Generator->GenerateLayoutBatch(FirstSeed, NumLayouts, MaxWorkers);
+		TestEqual(TEXT("Batch generates every layout"), Batch.Num(), NumLayouts);
+
+		FSimpleGridGenerationScratch Scratch;
+		for (int32 LayoutIndex = 0; LayoutIndex < Batch.Num(); LayoutIndex++)
+		{
+			FSimpleGridLayoutData Layout;
+			Generator->GenerateLayoutData(FirstSeed + LayoutIndex, Scratch, Layout);
+			TestTrue(FString::Printf(TEXT("Batch layout %d on %d workers matches its seed generated alone"), LayoutIndex, MaxWorkers), AreLayoutsEqual(Batch[LayoutIndex], Layout));
+		}
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSimpleGridBatchPerfTest, "DungeonForge.SimpleGridGenerator.Perf.BatchThroughput", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FSimpleGridBatchPerfTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumLayouts = 256;
+	const int32 NumThreads = FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+	for (const int32 NumRooms : { 50, 200 })
+	{
+		const USimpleGridDungeonGenerator* Generator = MakeGenerator(NumRooms);
+
+		FSimpleGridGenerationScratch Scratch;
+		FSimpleGridLayoutData Layout;
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Seed = 0; Seed < NumLayouts; Seed++)
+		{
+			Generator->GenerateLayoutData(Seed, Scratch, Layout);
+		}
+		const double SerialRate = NumLayouts / FMath::Max(FPlatformTime::Seconds() - StartTime, UE_DOUBLE_SMALL_NUMBER);
+		AddInfo(FString::Printf(TEXT("%d layouts of %d rooms, one at a time: %.1f layouts/s"), NumLayouts, NumRooms, SerialRate));
+
+		for (const int32 NumWorkers : { 1, 2, 4, 8, NumThreads })
+		{
+			const double BatchStartTime = FPlatformTime::Seconds();
+			const TArray<FSimpleGridLayoutData> Batch = Generator->GenerateLayoutBatch(0, NumLayouts, NumWorkers);
+			const double BatchRate = NumLayouts / FMath::Max(FPlatformTime::Seconds() - BatchStartTime, UE_DOUBLE_SMALL_NUMBER);
+			TestEqual(TEXT("Batch generates every layout"), Batch.Num(), NumLayouts);
+
+			AddInfo(FString::Printf(TEXT("%d layouts of %d rooms, batch on %d workers: %.1f layouts/s (%.1f layouts/s per worker, %.2fx one at a time)"),
+				NumLayouts, NumRooms, NumWorkers, BatchRate, BatchRate / NumWorkers, BatchRate / FMath::Max(SerialRate, UE_DOUBLE_SMALL_NUMBER)));
+		}
+	}
+
+	return true;
+}
+
+#endif
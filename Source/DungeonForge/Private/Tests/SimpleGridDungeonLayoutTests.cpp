@@ -0,0 +1,354 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Layouts/SimpleGridDungeonLayout.h"
+
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	/**
+	 * Room and corridor tiles for a test layout, with every floor tile in one set for the brute-force checks.
+	 */
+	struct FTestFloor
+	{
+		TArray<FGridCoordinate> RoomTiles;
+		TArray<FGridCoordinate> CorridorTiles;
+		TSet<FGridCoordinate> AllTiles;
+
+		void AddRoomTile(const FGridCoordinate& Tile)
+		{
+			bool bAlreadyFloor = false;
+			AllTiles.Add(Tile, &bAlreadyFloor);
+			if (!bAlreadyFloor) RoomTiles.Add(Tile);
+		}
+
+		void AddCorridorTile(const FGridCoordinate& Tile)
+		{
+			bool bAlreadyFloor = false;
+			AllTiles.Add(Tile, &bAlreadyFloor);
+			if (!bAlreadyFloor) CorridorTiles.Add(Tile);
+		}
+	};
+
+	/**
+	 * Makes a floor of random rectangles and scattered tiles on both sides of zero, with blobs straddling the 64 tile chunk
+	 * boundaries so walls and corners cross between chunks.
+	 */
+	FTestFloor MakeSeededFloor(const int32 Seed)
+	{
+		FRandomStream RandomStream(Seed);
+		FTestFloor Floor;
+
+		for (const int32 Boundary : { -128, -64, 0, 64, 128 })
+		{
+			const FGridCoordinate Centre(Boundary + RandomStream.RandRange(-2, 2), Boundary + RandomStream.RandRange(-2, 2));
+			for (const FGridCoordinate& Tile : FRectBox(Centre + FGridCoordinate(-3, -3), Centre + FGridCoordinate(3, 3)).GetFillCoordinates())
+			{
+				Floor.AddRoomTile(Tile);
+			}
+		}
+
+		for (int32 RectIndex = 0; RectIndex < 40; RectIndex++)
+		{
+			const FGridCoordinate Origin(RandomStream.RandRange(-150, 150), RandomStream.RandRange(-150, 150));
+			const FGridCoordinate Bound = Origin + FGridCoordinate(RandomStream.RandRange(0, 12), RandomStream.RandRange(0, 12));
+			for (const FGridCoordinate& Tile : FRectBox(Origin, Bound).GetFillCoordinates())
+			{
+				if (RectIndex % 2 == 0)
+				{
+					Floor.AddRoomTile(Tile);
+				}
+				else
+				{
+					Floor.AddCorridorTile(Tile);
+				}
+			}
+		}
+
+		for (int32 TileIndex = 0; TileIndex < 500; TileIndex++)
+		{
+			Floor.AddCorridorTile(FGridCoordinate(RandomStream.RandRange(-150, 150), RandomStream.RandRange(-150, 150)));
+		}
+		return Floor;
+	}
+
+	/**
+	 * Rectangles for a test layout, kept apart from each other and from the floor's tiles.
+	 */
+	struct FTestRects
+	{
+		TArray<FRectBox> RoomRects;
+		TArray<FRectBox> CorridorRects;
+	};
+
+	/**
+	 * Adds non-overlapping room and corridor rectangles to a floor made by MakeSeededFloor. A few span several 64 tile chunks, and
+	 * some pairs touch so the walls between rectangles are skipped. Every rectangle tile also goes in Floor.AllTiles.
+	 */
+	FTestRects AddSeededRects(const int32 Seed, FTestFloor& Floor)
+	{
+		FTestRects Rects;
+		const auto TryAdd = [&Floor](const FRectBox& Rect, TArray<FRectBox>& OutRects)
+		{
+			// Rectangles mustn't overlap each other or the floor's tiles
+			for (const FGridCoordinate& Tile : Rect.GetFillCoordinates())
+			{
+				if (Floor.AllTiles.Contains(Tile)) return;
+			}
+			OutRects.Add(Rect);
+			Floor.AllTiles.Append(Rect.GetFillCoordinates());
+		};
+
+		// Pairs touching across the chunk boundaries at 256, 192 and -192, away from the floor's tiles so they are always added
+		TryAdd(FRectBox(FGridCoordinate(200, 40), FGridCoordinate(255, 70)), Rects.RoomRects);
+		TryAdd(FRectBox(FGridCoordinate(256, 50), FGridCoordinate(300, 52)), Rects.CorridorRects);
+		TryAdd(FRectBox(FGridCoordinate(170, 200), FGridCoordinate(191, 240)), Rects.RoomRects);
+		TryAdd(FRectBox(FGridCoordinate(192, 210), FGridCoordinate(230, 212)), Rects.CorridorRects);
+		TryAdd(FRectBox(FGridCoordinate(-230, -250), FGridCoordinate(-193, -200)), Rects.RoomRects);
+		TryAdd(FRectBox(FGridCoordinate(-192, -240), FGridCoordinate(-170, -210)), Rects.RoomRects);
+
+		FRandomStream RandomStream(Seed);
+		for (int32 Attempt = 0; Attempt < 60; Attempt++)
+		{
+			const FGridCoordinate Origin(RandomStream.RandRange(-300, 300), RandomStream.RandRange(-300, 300));
+			const FRectBox Rect(Origin, Origin + FGridCoordinate(RandomStream.RandRange(0, 80), RandomStream.RandRange(0, 20)));
+			TryAdd(Rect, Attempt % 2 == 0 ? Rects.RoomRects : Rects.CorridorRects);
+		}
+		return Rects;
+	}
+
+	USimpleGridDungeonLayout* MakeLayout(const FTestFloor& Floor)
+	{
+		USimpleGridDungeonLayout* Layout = NewObject<USimpleGridDungeonLayout>();
+		Layout->AddRoomTiles(Floor.RoomTiles);
+		Layout->AddCorridorTiles(Floor.CorridorTiles);
+		return Layout;
+	}
+
+	/**
+	 * Finds the walls the way they were imputed before the tile bitmap: a wall between every floor tile and each of its non-floor neighbours.
+	 */
+	TSet<FGridEdge> FindWallsBruteForce(const TSet<FGridCoordinate>& FloorTiles)
+	{
+		TSet<FGridEdge> Walls;
+		for (const FGridCoordinate& Coord : FloorTiles)
+		{
+			for (const FGridCoordinate& Neighbour : UGridCoordinateHelperLibrary::GetAdjacentCoordinates(Coord))
+			{
+				if (FloorTiles.Contains(Neighbour)) continue;
+				Walls.Add(FGridEdge(Coord, Neighbour));
+			}
+		}
+		return Walls;
+	}
+
+	/**
+	 * Finds the corners the way they were before vertex classification, by testing every pair of walls for two that meet at right angles.
+	 */
+	TSet<FGridCorner> FindCornersPairwise(const TArray<FGridEdge>& Walls)
+	{
+		TSet<FGridCorner> Corners;
+		for (const FGridEdge& WallA : Walls)
+		{
+			for (const FGridEdge& WallB : Walls)
+			{
+				if (!WallA.FormsCorner(WallB)) continue;
+				Corners.Add(FGridCorner::FromEdges(WallA, WallB));
+			}
+		}
+		return Corners;
+	}
+
+	/**
+	 * @return How many of Actual are missing from Expected, are repeated, or are missing from Actual, so zero means they hold the same values once each.
+	 */
+	template <typename ElementType>
+	int32 CountMismatches(TConstArrayView<ElementType> Actual, const TSet<ElementType>& Expected)
+	{
+		TSet<ElementType> Seen;
+		int32 NumMismatches = 0;
+		for (const ElementType& Element : Actual)
+		{
+			bool bAlreadySeen = false;
+			Seen.Add(Element, &bAlreadySeen);
+			NumMismatches += (bAlreadySeen || !Expected.Contains(Element)) ? 1 : 0;
+		}
+		for (const ElementType& Element : Expected)
+		{
+			NumMismatches += Seen.Contains(Element) ? 0 : 1;
+		}
+		return NumMismatches;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLayoutImputedWallsTest, "DungeonForge.SimpleGridLayout.ImputedWallsMatchBruteForce", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FLayoutImputedWallsTest::RunTest(const FString& Parameters)
+{
+	for (int32 Seed = 0; Seed < 8; Seed++)
+	{
+		const FTestFloor Floor = MakeSeededFloor(Seed);
+		const USimpleGridDungeonLayout* Layout = MakeLayout(Floor);
+		const TSet<FGridEdge> ExpectedWalls = FindWallsBruteForce(Floor.AllTiles);
+
+		TestEqual(FString::Printf(TEXT("Seed %d: walls match the per-tile neighbour search"), Seed), CountMismatches(Layout->ViewWallPositions(), ExpectedWalls), 0);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLayoutCornerPillarsTest, "DungeonForge.SimpleGridLayout.CornerPillarsMatchPairwiseWalls", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FLayoutCornerPillarsTest::RunTest(const FString& Parameters)
+{
+	for (int32 Seed = 0; Seed < 4; Seed++)
+	{
+		const FTestFloor Floor = MakeSeededFloor(Seed);
+		const TArray<FGridEdge> FloorWalls = FindWallsBruteForce(Floor.AllTiles).Array();
+
+		const USimpleGridDungeonLayout* ImputedLayout = MakeLayout(Floor);
+		TestEqual(FString::Printf(TEXT("Seed %d: corners from tiles match pairs of walls"), Seed),
+			CountMismatches(ImputedLayout->ViewCornerPillarPositions(), FindCornersPairwise(FloorWalls)), 0);
+
+		// Explicit walls needn't follow the floor, so add stray edges and knock some out as doors. The stray edges are built
+		// with their coordinates either way round, as the vertex masks rely on FGridEdge::Sort putting the lower packed key first.
+		FRandomStream RandomStream(Seed);
+		TArray<FGridEdge> Walls = FloorWalls;
+		for (int32 EdgeIndex = 0; EdgeIndex < 2000; EdgeIndex++)
+		{
+			const FGridCoordinate Tile(RandomStream.RandRange(-100, 100), RandomStream.RandRange(-100, 100));
+			const FGridCoordinate Neighbour = RandomStream.RandBool() ? FGridCoordinate(Tile.X + 1, Tile.Y) : FGridCoordinate(Tile.X, Tile.Y + 1);
+			Walls.Add(RandomStream.RandBool() ? FGridEdge(Tile, Neighbour) : FGridEdge(Neighbour, Tile));
+		}
+		TArray<FGridEdge> Doors;
+		for (int32 DoorIndex = 0; DoorIndex < Walls.Num() / 10; DoorIndex++)
+		{
+			Doors.Add(Walls[RandomStream.RandHelper(Walls.Num())]);
+		}
+
+		USimpleGridDungeonLayout* ExplicitLayout = MakeLayout(Floor);
+		ExplicitLayout->bImputesWallPositions = false;
+		ExplicitLayout->AddWalls(Walls);
+		ExplicitLayout->AddDoors(Doors);
+
+		const TArray<FGridEdge> ExpectedWalls = TSet<FGridEdge>(Walls).Difference(TSet<FGridEdge>(Doors)).Array();
+		TestEqual(FString::Printf(TEXT("Seed %d: explicit walls leave out the doors"), Seed),
+			CountMismatches(ExplicitLayout->ViewWallPositions(), TSet<FGridEdge>(ExpectedWalls)), 0);
+		TestEqual(FString::Printf(TEXT("Seed %d: corners from explicit walls match pairs of walls"), Seed),
+			CountMismatches(ExplicitLayout->ViewCornerPillarPositions(), FindCornersPairwise(ExpectedWalls)), 0);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLayoutDerivedDataInvalidationTest, "DungeonForge.SimpleGridLayout.ViewsFollowChanges", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FLayoutDerivedDataInvalidationTest::RunTest(const FString& Parameters)
+{
+	FTestFloor Floor = MakeSeededFloor(0);
+	USimpleGridDungeonLayout* Layout = MakeLayout(Floor);
+
+	// Each check reads every view first, so a cache left over from before a change would be caught
+	const auto CheckViews = [this, &Floor, Layout](const TCHAR* Change)
+	{
+		const TSet<FGridEdge> ExpectedWalls = FindWallsBruteForce(Floor.AllTiles);
+		TestEqual(FString::Printf(TEXT("%s: floor tile count"), Change), Layout->GetNumFloorTiles(), Floor.AllTiles.Num());
+		TestEqual(FString::Printf(TEXT("%s: walls"), Change), CountMismatches(Layout->ViewWallPositions(), ExpectedWalls), 0);
+		TestEqual(FString::Printf(TEXT("%s: corner pillars"), Change), CountMismatches(Layout->ViewCornerPillarPositions(), FindCornersPairwise(ExpectedWalls.Array())), 0);
+	};
+	CheckViews(TEXT("Before any change"));
+
+	// Grow the floor against its existing edges and across a chunk boundary
+	uint32 Version = Layout->GetVersion();
+	TArray<FGridCoordinate> NewRoomTiles;
+	for (const FGridCoordinate& Tile : FRectBox(FGridCoordinate(60, -70), FGridCoordinate(70, -60)).GetFillCoordinates())
+	{
+		if (Floor.AllTiles.Contains(Tile)) continue;
+		Floor.AddRoomTile(Tile);
+		NewRoomTiles.Add(Tile);
+	}
+	Layout->AddRoomTiles(NewRoomTiles);
+	TestTrue(TEXT("Adding room tiles changes the version"), Layout->GetVersion() != Version);
+	CheckViews(TEXT("After AddRoomTiles"));
+
+	Version = Layout->GetVersion();
+	const FGridCoordinate CorridorTile(-200, 5);
+	Floor.AddCorridorTile(CorridorTile);
+	Layout->AddCorridorTiles({ CorridorTile });
+	TestTrue(TEXT("Adding corridor tiles changes the version"), Layout->GetVersion() != Version);
+	CheckViews(TEXT("After AddCorridorTiles"));
+
+	Version = Layout->GetVersion();
+	const FRectBox Rect(FGridCoordinate(300, 300), FGridCoordinate(310, 304));
+	for (const FGridCoordinate& Tile : Rect.GetFillCoordinates())
+	{
+		Floor.AddRoomTile(Tile);
+	}
+	Layout->AddRoomRects({ Rect });
+	TestTrue(TEXT("Adding room rects changes the version"), Layout->GetVersion() != Version);
+	CheckViews(TEXT("After AddRoomRects"));
+
+	const FGridEdge Door(CorridorTile, FGridCoordinate(CorridorTile.X + 1, CorridorTile.Y));
+	TestEqual(TEXT("No doors before AddDoors"), Layout->ViewDoorPositions().Num(), 0);
+	Layout->AddDoors({ Door });
+	TestTrue(TEXT("The new door is in the view"), Layout->ViewDoorPositions().Num() == 1 && Layout->ViewDoorPositions()[0] == Door);
+
+	// Switching to explicit walls must drop the imputed ones, and the door must cut the wall it sits on
+	const FGridEdge OtherWall(CorridorTile, FGridCoordinate(CorridorTile.X, CorridorTile.Y + 1));
+	Layout->bImputesWallPositions = false;
+	TestEqual(TEXT("Explicit layouts have no walls until some are added"), Layout->ViewWallPositions().Num(), 0);
+	Layout->AddWalls({ Door, OtherWall });
+	TestTrue(TEXT("Explicit walls leave out the door"), Layout->ViewWallPositions().Num() == 1 && Layout->ViewWallPositions()[0] == OtherWall);
+
+	Layout->bImputesWallPositions = true;
+	CheckViews(TEXT("After switching back to imputed walls"));
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLayoutRectWallsTest, "DungeonForge.SimpleGridLayout.RectWallsMatchTiles", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FLayoutRectWallsTest::RunTest(const FString& Parameters)
+{
+	for (int32 Seed = 0; Seed < 4; Seed++)
+	{
+		FTestFloor Floor = MakeSeededFloor(Seed);
+		const FTestRects Rects = AddSeededRects(Seed, Floor);
+
+		// The same floor twice: once keeping the rectangles whole, and once filled in tile by tile
+		USimpleGridDungeonLayout* RectLayout = MakeLayout(Floor);
+		RectLayout->AddRoomRects(Rects.RoomRects);
+		RectLayout->AddCorridorRects(Rects.CorridorRects);
+
+		USimpleGridDungeonLayout* TileLayout = MakeLayout(Floor);
+		for (const FRectBox& Rect : Rects.RoomRects)
+		{
+			TileLayout->AddRoomTiles(Rect.GetFillCoordinates());
+		}
+		for (const FRectBox& Rect : Rects.CorridorRects)
+		{
+			TileLayout->AddCorridorTiles(Rect.GetFillCoordinates());
+		}
+
+		TestEqual(FString::Printf(TEXT("Seed %d: both layouts hold the same number of tiles"), Seed), RectLayout->GetNumFloorTiles(), Floor.AllTiles.Num());
+		TestEqual(FString::Printf(TEXT("Seed %d: tile layout holds the same number of tiles"), Seed), TileLayout->GetNumFloorTiles(), Floor.AllTiles.Num());
+
+		int32 NumFloorMismatches = 0;
+		for (const FGridCoordinate& Tile : Floor.AllTiles)
+		{
+			NumFloorMismatches += RectLayout->IsFloorTile(Tile) ? 0 : 1;
+		}
+		TestEqual(FString::Printf(TEXT("Seed %d: every tile is floor in the rect layout"), Seed), NumFloorMismatches, 0);
+
+		const TSet<FGridEdge> ExpectedWalls = FindWallsBruteForce(Floor.AllTiles);
+		TestEqual(FString::Printf(TEXT("Seed %d: rect walls match the per-tile neighbour search"), Seed), CountMismatches(RectLayout->ViewWallPositions(), ExpectedWalls), 0);
+		TestEqual(FString::Printf(TEXT("Seed %d: filled tile walls match the per-tile neighbour search"), Seed), CountMismatches(TileLayout->ViewWallPositions(), ExpectedWalls), 0);
+
+		const TSet<FGridCorner> TileCorners(TileLayout->ViewCornerPillarPositions());
+		TestEqual(FString::Printf(TEXT("Seed %d: rect corner pillars match the filled tile layout"), Seed), CountMismatches(RectLayout->ViewCornerPillarPositions(), TileCorners), 0);
+	}
+	return true;
+}
+
+#endif
@@ -7,24 +7,74 @@
 #include "BSPDungeonGenerator.generated.h"
 
 /**
- * A simple structure to define a rectilinear box.
- * The box origin represents the top-left corner of the box.
- * The box bound represents the bottom-right corner of the box. 
+ * The parameters of a BSP generated dungeon.
  */
-USTRUCT()
-struct FRectBox
+USTRUCT(BlueprintType)
+struct DUNGEONFORGE_API FBSPGenerationSettings
 {
 	GENERATED_BODY()
 
-	FRectBox();
-	FRectBox(const FGridCoordinate InBoxOrigin, const FGridCoordinate InBoxBound);
-	
-	FGridCoordinate BoxOrigin;
-	FGridCoordinate BoxBound;
+	/**
+	 * The size of the area that is partitioned into rooms, in tiles.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings", meta=(ClampMin=1))
+	int32 GridWidth = 10;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings", meta=(ClampMin=1))
+	int32 GridHeight = 10;
 
-	int32 GetVolume() const;
+	/**
+	 * The number of rooms to split the area into. Fewer are generated if the rooms can't be split any further.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings", meta=(ClampMin=1))
+	int32 RoomCount = 16;
 
-	TArray<FGridCoordinate> GetFillCoordinates() const;
+	/**
+	 * The width of the gap left between the two halves of every split.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings", meta=(ClampMin=1))
+	int32 CorridorWidth = 1;
+
+	/**
+	 * No split makes a room narrower than this, in either direction.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings", meta=(ClampMin=1))
+	int32 MinRoomWidth = 2;
+
+	/**
+	 * Splits the area as a tree, sharing the room count between the two halves of each split by area, instead of always splitting the widest room.
+	 * The halves of each split are independent, so large subtrees are split in parallel. The layout doesn't depend on the number of threads.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings|Recursive Subdivision")
+	bool bRecursiveSubdivision = false;
+
+	/**
+	 * Subtrees covering at least this many tiles have their two halves split in parallel.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings|Recursive Subdivision", meta=(EditCondition="bRecursiveSubdivision", ClampMin=1))
+	int32 ParallelSubdivisionMinArea = 65536;
+};
+
+/**
+ * Two rooms facing each other across a corridor gap, and the straight corridor joining them.
+ */
+struct DUNGEONFORGE_API FBSPRoomConnection
+{
+	/**
+	 * Indices into the layout's room rectangles. RoomA is the room nearer the origin.
+	 */
+	int32 RoomA;
+	int32 RoomB;
+
+	/**
+	 * The corridor tiles, one tile wide, running across the gap from RoomA to RoomB.
+	 */
+	FRectBox Corridor;
+
+	/**
+	 * The doors at each end of the corridor, between the last tile of each room and the corridor.
+	 */
+	FGridEdge DoorA;
+	FGridEdge DoorB;
 };
 
 /**
@@ -37,12 +87,49 @@ class DUNGEONFORGE_API UBSPDungeonGenerator : public UObject
 	
 public:
 	/**
-	 * 
+	 * @param Seed Seeds every random choice, so the same seed always generates the same layout.
 	 */
 	UFUNCTION(BlueprintCallable)
-	USimpleGridDungeonLayout* GenerateLayout();
+	USimpleGridDungeonLayout* GenerateLayout(const int32 Seed);
+
+	/**
+	 * Generates a layout as plain data, without creating any UObjects, so it is safe to call off the game thread.
+	 */
+	void GenerateLayoutData(const int32 Seed, FSimpleGridLayoutData& OutLayoutData) const;
+
+	/**
+	 * As above, also returning the graph of which rooms are connected to which.
+	 */
+	void GenerateLayoutData(const int32 Seed, FSimpleGridLayoutData& OutLayoutData, TArray<FBSPRoomConnection>& OutConnections) const;
+
+	void SetGenerationSettings(const FBSPGenerationSettings& InSettings);
+
+	/**
+	 * Splits Box into at most RoomBudget rooms by always splitting the widest room, appending them to OutRooms. The rooms are kept in a
+	 * max-heap on their extent, so each split costs O(log n).
+	 */
+	static void SubdivideWidestFirst(const FRectBox& Box, const int32 RoomBudget, const int32 Seed, const FBSPGenerationSettings& InSettings, TArray<FRectBox>& OutRooms);
+
+	/**
+	 * Picks a random split of the box, choosing the direction first and then the position, without building a list of candidates.
+	 * @return False if the box is too small to split in either direction.
+	 */
+	static bool ChooseRandomBoxSplit(const FRectBox& Box, const int32 CorridorWidth, const int32 MinRoomWidth, FRandomStream& RandomStream, FRectBox& OutBoxA, FRectBox& OutBoxB);
 
 protected:
-	static TArray<TArray<FRectBox>> GetAllPossibleBoxSplits(const FRectBox& Box, int32 CorridorLength, int32 MinRoomWidth);
-	static TArray<TArray<FRectBox>> GetTwoRandomPossibleBoxSplits(const FRectBox& Box, const int32 CorridorLength, const int32 MinRoomWidth);
+	FBSPGenerationSettings Settings;
+
+	/**
+	 * Splits Box into at most RoomBudget rooms, appending them to OutRooms. Each split seeds the substreams of its two halves from its own stream,
+	 * so every subtree is generated the same way whichever thread it runs on.
+	 */
+	static void SubdivideRecursive(const FRectBox& Box, const int32 RoomBudget, const int32 Seed, const FBSPGenerationSettings& InSettings, TArray<FRectBox>& OutRooms);
+
+	/**
+	 * Finds every pair of rooms facing each other across a gap exactly CorridorWidth tiles wide, and joins each pair with a corridor at a random
+	 * point along the span they share. Sweeps the rooms sorted by the edges on each side of a gap, so it is O(n log n) rather than testing every pair.
+	 */
+	static void ConnectFacingRooms(TConstArrayView<FRectBox> Rooms, const int32 CorridorWidth, FRandomStream& RandomStream, TArray<FBSPRoomConnection>& OutConnections);
+
+	static TArray<TArray<FRectBox>> GetAllPossibleBoxSplits(const FRectBox& Box, int32 CorridorWidth, int32 MinRoomWidth);
 };
@@ -0,0 +1,196 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SimpleGridDungeonGenerator.h"
+#include "Subsystems/EngineSubsystem.h"
+#include "RoomOffsetCacheSubsystem.generated.h"
+
+/**
+ * A catalogue of room shapes, together with the precomputed offsets at which each shape can be placed touching each other shape.
+ * Shapes are interned to integer IDs (their index in the catalogue), so placed rooms only need to store an ID and an origin.
+ * Immutable once built, so a single catalogue can be shared by every generator using the same shapes.
+ */
+struct DUNGEONFORGE_API FRoomShapeCatalogue
+{
+	/**
+	 * The tiles of every shape, sorted by packed key and relative to the shape's origin. Indexed by shape ID.
+	 */
+	TArray<TArray<FGridCoordinate>> ShapeTiles;
+
+	/**
+	 * The offsets of every ordered pair of shapes, stored back to back. The offsets where B can be placed touching A
+	 * are the span starting at PairOffsetStarts[A * NumShapes + B] and ending at the next start.
+	 */
+	TArray<FGridCoordinate> PairOffsets;
+	TArray<int32> PairOffsetStarts;
+
+	/**
+	 * The offsets from an instance of A at which B can't be placed, because B would overlap A or B's origin would be inside A.
+	 * Stored the same way as PairOffsets. Placing A invalidates any candidate position of B at one of these offsets from it.
+	 */
+	TArray<FGridCoordinate> BlockedOffsets;
+	TArray<int32> BlockedOffsetStarts;
+
+	/**
+	 * A shape's tiles as one 64-bit mask per row of its bounding box, for testing it against an occupancy bitmap a row at a time.
+	 */
+	struct FShapeFootprint
+	{
+		/**
+		 * The bottom-left corner of the shape's bounding box, relative to the shape's origin.
+		 */
+		FGridCoordinate BottomLeft;
+
+		/**
+		 * Bit i of row r is the tile at BottomLeft + (i, r).
+		 */
+		TArray<uint64> RowMasks;
+	};
+
+	/**
+	 * The footprint of every shape, indexed by shape ID.
+	 */
+	TArray<FShapeFootprint> Footprints;
+
+	/**
+	 * The wall edges around every shape, relative to the shape's origin and indexed by shape ID.
+	 * Each edge goes from the tile outside the shape to the tile inside it.
+	 */
+	TArray<TArray<FGridEdge>> ShapePerimeters;
+
+	/**
+	 * The door candidates for every entry of PairOffsets, stored back to back: the candidates for PairOffsets[i] are the span
+	 * starting at DoorCandidateStarts[i] and ending at the next start. Each candidate is an edge from a tile of B to a neighbouring
+	 * tile of A, relative to A's origin. There is one candidate per tile of B touching A, so every such tile is equally likely to get the door.
+	 */
+	TArray<FGridEdge> DoorCandidates;
+	TArray<int32> DoorCandidateStarts;
+
+	/**
+	 * A hash of the shapes in the catalogue, used as the cache key.
+	 */
+	uint32 ContentHash = 0;
+
+	int32 NumShapes() const { return ShapeTiles.Num(); }
+
+	TConstArrayView<FGridCoordinate> GetShapeTiles(const int32 ShapeId) const
+	{
+		return ShapeTiles[ShapeId];
+	}
+
+	/**
+	 * @return The offsets from an instance of ShapeA at which an instance of ShapeB touches it without overlapping.
+	 */
+	TConstArrayView<FGridCoordinate> GetPairOffsets(const int32 ShapeA, const int32 ShapeB) const
+	{
+		const int32 PairIndex = ShapeA * NumShapes() + ShapeB;
+		return MakeArrayView(PairOffsets.GetData() + PairOffsetStarts[PairIndex], PairOffsetStarts[PairIndex + 1] - PairOffsetStarts[PairIndex]);
+	}
+
+	/**
+	 * @return The index in PairOffsets of the first offset for this pair of shapes.
+	 */
+	int32 GetPairOffsetsStart(const int32 ShapeA, const int32 ShapeB) const
+	{
+		return PairOffsetStarts[ShapeA * NumShapes() + ShapeB];
+	}
+
+	/**
+	 * @return The door candidates for the offset at PairOffsets[PairOffsetIndex], relative to the origin of the first shape of the pair.
+	 */
+	TConstArrayView<FGridEdge> GetDoorCandidates(const int32 PairOffsetIndex) const
+	{
+		return MakeArrayView(DoorCandidates.GetData() + DoorCandidateStarts[PairOffsetIndex], DoorCandidateStarts[PairOffsetIndex + 1] - DoorCandidateStarts[PairOffsetIndex]);
+	}
+
+	TConstArrayView<FGridEdge> GetShapePerimeter(const int32 ShapeId) const
+	{
+		return ShapePerimeters[ShapeId];
+	}
+
+	/**
+	 * @return The offsets from an instance of ShapeA at which an instance of ShapeB can never be placed.
+	 */
+	TConstArrayView<FGridCoordinate> GetBlockedOffsets(const int32 ShapeA, const int32 ShapeB) const
+	{
+		const int32 PairIndex = ShapeA * NumShapes() + ShapeB;
+		return MakeArrayView(BlockedOffsets.GetData() + BlockedOffsetStarts[PairIndex], BlockedOffsetStarts[PairIndex + 1] - BlockedOffsetStarts[PairIndex]);
+	}
+
+	const FShapeFootprint& GetFootprint(const int32 ShapeId) const
+	{
+		return Footprints[ShapeId];
+	}
+
+	static TSharedRef<FRoomShapeCatalogue> Build(const TArray<FDungeonRoom>& InShapes);
+	static TSharedRef<FRoomShapeCatalogue> Build(TArray<TArray<FGridCoordinate>>&& InShapeTiles);
+
+	/**
+	 * @return The tiles of each shape in sorted order, so the same shape always interns to the same tile list.
+	 */
+	static TArray<TArray<FGridCoordinate>> InternShapes(const TArray<FDungeonRoom>& InShapes);
+	static uint32 ComputeContentHash(const TArray<TArray<FGridCoordinate>>& InShapeTiles);
+
+	/**
+	 * Reads or writes the catalogue in a compact binary form: the shapes' tiles, then the flat pair offset tables.
+	 */
+	void Serialize(FArchive& Ar);
+
+	/**
+	 * Computes the pair offset and blocked offset tables from ShapeTiles. This is the expensive part of building a catalogue.
+	 */
+	void BuildPairTables();
+
+	/**
+	 * Computes the footprints, perimeters and door candidates from ShapeTiles and PairOffsets.
+	 * These are cheap to derive, so they are rebuilt after loading rather than serialized. Shapes must be at most 64 tiles wide.
+	 */
+	void BuildDerivedData();
+};
+
+/**
+ * An engine-wide cache of room shape catalogues, keyed by the content hash of their shapes.
+ * Building the pairwise offset tables is the expensive part of initialising a generator, and the shapes rarely change,
+ * so every dungeon instance shares the same tables. Optionally persisted to disk so the tables are loaded at startup.
+ */
+UCLASS(config=Game)
+class DUNGEONFORGE_API URoomOffsetCacheSubsystem : public UEngineSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	/**
+	 * @return The cached catalogue for these shapes, building and caching it first if needed. Safe to call from any thread.
+	 */
+	TSharedRef<const FRoomShapeCatalogue> FindOrBuildCatalogue(const TArray<FDungeonRoom>& Shapes);
+
+	/**
+	 * Uses the engine's cache if the engine is running, otherwise builds an uncached catalogue.
+	 */
+	static TSharedRef<const FRoomShapeCatalogue> GetCatalogue(const TArray<FDungeonRoom>& Shapes);
+
+	/**
+	 * Writes the cached catalogues to disk now, rather than waiting for shutdown.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Dungeon Forge")
+	void SaveToDisk();
+
+	/**
+	 * Whether catalogues are loaded from disk at startup and saved back when new ones have been built.
+	 */
+	UPROPERTY(config)
+	bool bPersistToDisk = false;
+
+protected:
+	FString GetCacheFilePath() const;
+	void LoadFromDisk();
+
+	FCriticalSection CacheLock;
+	TMap<uint32, TArray<TSharedRef<FRoomShapeCatalogue>>> Catalogues;
+	bool bHasUnsavedCatalogues = false;
+};
@@ -4,9 +4,13 @@
 
 #include "CoreMinimal.h"
 #include "Instances/SimpleGridDungeonInstance.h"
+#include "Layouts/GridTileBitmap.h"
+#include "Layouts/SimpleGridDungeonLayout.h"
 #include "UObject/Object.h"
 #include "SimpleGridDungeonGenerator.generated.h"
 
+struct FRoomShapeCatalogue;
+
 
 USTRUCT()
 struct FDungeonRoom
@@ -58,6 +62,106 @@ FORCEINLINE uint32 GetTypeHash(const FDungeonRoom& DungeonRoom)
 	}
 	return Hash;
 }
+
+/**
+ * A room placed by the generator: an interned shape from the generator's catalogue, and where its origin is in the layout.
+ */
+struct FPlacedRoom
+{
+	int32 ShapeId = INDEX_NONE;
+	FGridCoordinate Origin;
+};
+
+/**
+ * A door to be placed between a room and the earlier room it was placed touching.
+ */
+struct FRoomConnection
+{
+	int32 RoomIndex = INDEX_NONE;
+	int32 ParentRoomIndex = INDEX_NONE;
+
+	/**
+	 * The index in the catalogue's PairOffsets of the room's offset from its parent, which selects the door candidates.
+	 */
+	int32 PairOffsetIndex = INDEX_NONE;
+};
+
+/**
+ * The still-valid origins at which one shape can be placed touching the rooms placed so far, each with the room it would connect to.
+ * Candidates are kept in an array so one can be picked uniformly at random, with an index map so any candidate can be removed in O(1).
+ */
+struct FRoomPlacementFrontier
+{
+	struct FCandidate
+	{
+		FGridCoordinate Origin;
+		int32 ParentRoomIndex = INDEX_NONE;
+		int32 PairOffsetIndex = INDEX_NONE;
+	};
+
+	TArray<FCandidate> Candidates;
+	TMap<FGridCoordinate, int32> CandidateIndices;
+
+	int32 Num() const { return Candidates.Num(); }
+	bool Contains(const FGridCoordinate& Origin) const { return CandidateIndices.Contains(Origin); }
+
+	/**
+	 * Adds a candidate, unless there is already one at this origin.
+	 */
+	void Add(const FGridCoordinate& Origin, int32 ParentRoomIndex, int32 PairOffsetIndex);
+	void Remove(const FGridCoordinate& Origin);
+	void Reset();
+};
+
+/**
+ * The working state of a single generation. Kept out of the generator so several layouts can be generated at once,
+ * and reused between generations so a worker thread only allocates for its first layout.
+ */
+struct FSimpleGridGenerationScratch
+{
+	TArray<int32> PossibleShapeIds;
+	TArray<FPlacedRoom> RoomLayout;
+	FGridTileBitmap RoomLayoutUsedCoords;
+	TArray<FRoomPlacementFrontier> Frontiers;
+	TArray<FRoomConnection> RoomConnections;
+
+	/**
+	 * Whether placing a room tests the new candidate origins on several threads.
+	 */
+	bool bParallelPlacement = false;
+
+	/**
+	 * The most shards a placement's candidates are split into with bParallelPlacement, which caps how many threads work on it at once.
+	 * Zero allows one per task graph worker plus the calling thread.
+	 */
+	int32 MaxPlacementWorkers = 0;
+
+	/**
+	 * A candidate origin which passed the overlap test, waiting to be merged into its shape's frontier.
+	 */
+	struct FPlacementCandidate
+	{
+		int32 ShapeId = INDEX_NONE;
+		FGridCoordinate Origin;
+		int32 PairOffsetIndex = INDEX_NONE;
+	};
+
+	/**
+	 * Where each possible shape's offsets start in the flattened list of offsets around the room being placed, plus the total at the end.
+	 */
+	TArray<int32> PlacementOffsetStarts;
+
+	/**
+	 * The candidates each shard of a placement found, in offset order. Merged in shard order, so the frontiers don't depend on the shard count.
+	 */
+	TArray<TArray<FPlacementCandidate>> ShardCandidates;
+
+	/**
+	 * Clears the state for a new generation, keeping the allocations.
+	 */
+	void Reset(int32 NumShapes);
+};
+
 /**
  * 
  */
@@ -69,33 +173,90 @@ class DUNGEONFORGE_API USimpleGridDungeonGenerator : public UObject
 public:
 	/**
 	 * A very simple dungeon generator which keeps adding rooms in an arbitrary position to the layout until it reaches a certain room count.
+	 * @param Seed Seeds every random choice, so the same seed and room count always generate the same layout.
 	 * @return The generated layout.
 	 */
 	UFUNCTION(BlueprintCallable)
-	USimpleGridDungeonLayout* GenerateLayout();
+	USimpleGridDungeonLayout* GenerateLayout(const int32 Seed);
+
+	/**
+	 * Generates a layout as plain data, without creating any UObjects. Only reads the generator, so it is safe to call from
+	 * several threads at once as long as the generator isn't reconfigured meanwhile.
+	 * @param Scratch Working buffers for the generation. Reusing the same scratch between calls avoids reallocating.
+	 */
+	void GenerateLayoutData(const int32 Seed, FSimpleGridGenerationScratch& Scratch, FSimpleGridLayoutData& OutLayoutData) const;
+
+	/**
+	 * Generates NumLayouts layouts with consecutive seeds starting at FirstSeed, spread across worker threads with a scratch per worker.
+	 * Blocks until every layout is done. Layout i is the same as GenerateLayout would give for seed FirstSeed + i.
+	 * @param MaxWorkers The most threads to generate on at once, including the calling thread. Zero uses every task graph worker.
+	 */
+	TArray<FSimpleGridLayoutData> GenerateLayoutBatch(const int32 FirstSeed, const int32 NumLayouts, const int32 MaxWorkers = 0) const;
 	
 	/**
 	 * An initialisation function to set the parameters of the generator.
-	 * It creates a datalist of possible rooms and calculates the offsets between them so that the generator runs faster at runtime/generation time.
+	 * It fetches the catalogue of possible rooms and the offsets between them so that the generator runs faster at runtime/generation time.
 	 * @param InRoomCount The number of rooms to generate.
 	 */
 	void SetNumRooms(const int32 InRoomCount);
 
+	/**
+	 * Whether each placement tests its new candidate origins in parallel on the task graph. The layout is the same either way.
+	 */
+	void SetParallelPlacement(const bool bInParallelPlacement);
+
+	/**
+	 * @return The shapes and offsets this generator places rooms from, or null before SetNumRooms.
+	 */
+	TSharedPtr<const FRoomShapeCatalogue> GetCatalogue() const { return Catalogue; }
+
+	/**
+	 * @return The relative coordinates, sorted, where an instance of RoomB can be offset from RoomA so that they touch without overlapping.
+	 */
+	static TArray<FGridCoordinate> GenerateOffsetsForRooms(TConstArrayView<FGridCoordinate> RoomA, TConstArrayView<FGridCoordinate> RoomB);
+
+	/**
+	 * @return The relative coordinates, sorted, where an instance of RoomB can't be offset from RoomA, because it would overlap RoomA or have its origin inside RoomA.
+	 */
+	static TArray<FGridCoordinate> GenerateBlockedOffsetsForRooms(TConstArrayView<FGridCoordinate> RoomA, TConstArrayView<FGridCoordinate> RoomB);
+
 protected:
 	int32 RoomCount;
-	TArray<FDungeonRoom> PossibleRooms;
+	bool bParallelPlacement = false;
 
 	/**
-	 * A map of pairs of rooms (A and B) to a list of relative coordinates where an instance of B can be offset from A.
+	 * Every room shape the generator knows about, and the offsets between each pair. Shared with other generators through URoomOffsetCacheSubsystem.
 	 */
-	TMap<TTuple<FDungeonRoom, FDungeonRoom>, TSet<FGridCoordinate>> RoomComboOffsetsMap;
-	
-	TArray<FDungeonRoom> InitPossibleRooms();
+	TSharedPtr<const FRoomShapeCatalogue> Catalogue;
+
+	/**
+	 * @return Every room shape that can be generated. Deterministic, so the same shapes always hit the same cached catalogue.
+	 */
+	static TArray<FDungeonRoom> InitPossibleRooms();
 
-	TMap<TTuple<FDungeonRoom, FDungeonRoom>, TSet<FGridCoordinate>> GenerateRoomComboOffsets(const TArray<FDungeonRoom>& Rooms);
-	TSet<FGridCoordinate> GenerateOffsetsForRooms(const TSet<FGridCoordinate>& RoomA, const TSet<FGridCoordinate>& RoomB);
+	/**
+	 * Fills OutShapeIds with a random selection of shape IDs, out of NumShapes, to use for a single generation.
+	 */
+	static void SamplePossibleShapes(int32 NumShapes, FRandomStream& RandomStream, TArray<int32>& OutShapeIds);
+
+	/**
+	 * Places one more room at a random candidate from the frontier of a random shape, and records its connection to the room it touches.
+	 */
+	void AddSingleRoomToLayout(FSimpleGridGenerationScratch& Scratch, FRandomStream& RandomStream) const;
 
-	void AddSingleRoomToLayout(TArray<FDungeonRoom> &RoomLayout, TSet<FGridCoordinate> &RoomLayoutUsedCoords, TMap<FDungeonRoom, FDungeonRoom>& RoomConnections) const;
+	/**
+	 * Adds a room to the layout and updates every possible shape's frontier. Only candidates within the new room's blocked offsets
+	 * are invalidated, and only positions touching the new room are added, so the cost doesn't grow with the number of rooms.
+	 * With bParallelPlacement the offsets of every shape around the new room are split into contiguous shards, tested on worker
+	 * threads into a buffer per shard, and merged in shard order, which is the order the serial path adds them in.
+	 */
+	void PlaceRoom(const FPlacedRoom& Room, FSimpleGridGenerationScratch& Scratch) const;
+
+	/**
+	 * @return True if neither the shape's tiles nor its origin would land on a used tile. Tests the shape's row mask footprint
+	 * against the occupancy bitmap, so it doesn't allocate.
+	 */
+	bool CanPlaceShape(int32 ShapeId, const FGridCoordinate& Origin, const FGridTileBitmap& RoomLayoutUsedCoords) const;
 	
 	UFUNCTION(BlueprintCallable)
 	static USimpleGridDungeonLayout* SimpleStaticLayout1();
@@ -4,11 +4,36 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
+#include "HAL/ThreadSafeBool.h"
+#include "Layouts/GridCoordinateHelperLibrary.h"
 #include "BaseDungeonInstance.generated.h"
 
+struct FSimpleGridLayoutData;
+class USimpleGridDungeonLayout;
+class UInstancedStaticMeshComponent;
+class UHierarchicalInstancedStaticMeshComponent;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE(FOnDungeonGenerated);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnDungeonSpawnProgress, float, Progress);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE(FOnDungeonSpawned);
+
+/**
+ * The categories of mesh a dungeon is spawned from. Each has its own instanced mesh component.
+ */
+enum class EDungeonMeshCategory : uint8
+{
+	RoomFloor,
+	CorridorFloor,
+	Wall,
+	Door,
+	Pillar,
+	Num
+};
+
 /**
  * A base class for dungeon instances. It is not meant to be used directly.
- * Contains high-level logic for deciding whether to spawn dungeons at runtime or design time.
+ * Contains high-level logic for deciding whether to spawn dungeons at runtime or design time,
+ * and the spawn pipeline which turns a layout into one instanced mesh component per category, or per category per cell.
  */
 UCLASS()
 class DUNGEONFORGE_API ABaseDungeonInstance : public AActor
@@ -29,6 +54,7 @@ public:
 	
 	/**
 	 * Use the layout generated by GenerateLayout() to spawn the dungeon.
+	 * Each category of tile is added to its instanced mesh component in one batch, or over several frames if time-sliced.
 	 */
 	virtual void SpawnDungeon();
 	
@@ -42,10 +68,370 @@ public:
 	 */
 	virtual void ClearDungeon();
 
+	virtual void Tick(float DeltaSeconds) override;
+
+	/**
+	 * @return True while a time-sliced spawn still has instances left to add.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Post-Generation Helpers")
+	bool IsSpawningDungeon() const;
+
+	/**
+	 * Broadcast after each frame of a time-sliced spawn, with the fraction of instances spawned so far.
+	 */
+	UPROPERTY(BlueprintAssignable, Category = "Post-Generation Helpers")
+	FOnDungeonSpawnProgress OnDungeonSpawnProgress;
+
+	/**
+	 * Broadcast once every instance of the dungeon has been spawned, whether the spawn was time-sliced or not.
+	 */
+	UPROPERTY(BlueprintAssignable, Category = "Post-Generation Helpers")
+	FOnDungeonSpawned OnDungeonSpawned;
+
+	/**
+	 * @return The cell containing the tile, or (0, 0) if the dungeon isn't split into cells.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Post-Generation Helpers")
+	FGridCoordinate GetCellForCoordinate(const FGridCoordinate& Coordinate) const;
+
+	/**
+	 * Shows or hides every instance in a cell and turns its collision on or off. Cells spawned later keep the setting.
+	 * Has no effect unless the dungeon is split into cells.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Post-Generation Helpers")
+	void SetCellEnabled(const FGridCoordinate& Cell, bool bEnabled);
+
+	UFUNCTION(BlueprintCallable, Category = "Post-Generation Helpers")
+	bool IsCellEnabled(const FGridCoordinate& Cell) const;
+
+	/**
+	 * Spawns the cells near the viewers and releases the ones far from them. Called periodically with the players' view locations while streaming
+	 * if bAutoUpdateStreaming is set, and can be called directly with any locations, e.g. to drive streaming without players.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Post-Generation Helpers")
+	void UpdateStreaming(const TArray<FVector>& ViewerLocations);
+
+	/**
+	 * @return True if the spawned dungeon is being streamed in and out around the players.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Post-Generation Helpers")
+	bool IsStreamingDungeon() const;
+
+	/**
+	 * @return True if the cell's instances are spawned.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Post-Generation Helpers")
+	bool IsCellLoaded(const FGridCoordinate& Cell) const;
+
+	/**
+	 * @return The number of cells spawned by streaming.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Post-Generation Helpers")
+	int32 GetNumLoadedCells() const;
+
+	/**
+	 * Generates the layout on a background thread, then clears and spawns the dungeon on the game thread once it is ready.
+	 * Supersedes any async generation still in flight. OnDungeonGenerated is broadcast when the dungeon has been spawned.
+	 */
+	UFUNCTION(BlueprintCallable, Category="Generator Functions")
+	void GenerateDungeonAsync();
+
+	/**
+	 * Cancels the async generation in flight, if any. The current dungeon is left as it is.
+	 */
+	UFUNCTION(BlueprintCallable, Category="Generator Functions")
+	void CancelDungeonGeneration();
+
+	UFUNCTION(BlueprintCallable, Category="Generator Functions")
+	bool IsGeneratingDungeon() const;
+
+	UPROPERTY(BlueprintAssignable, Category="Generator Functions")
+	FOnDungeonGenerated OnDungeonGenerated;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings")
 	float GridSize = 500.f;
 
+	/**
+	 * The seed for generation. The same seed and settings always generate the same layout.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings")
+	int32 Seed = 0;
+
+	/**
+	 * Picks a new seed for every generation. The seed picked is written back to Seed, so the layout can be reproduced.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generator Settings")
+	bool bRandomiseSeed = true;
+
 protected:
+	/**
+	 * @return The seed to generate the next layout with, after picking a new one if bRandomiseSeed is set.
+	 */
+	int32 GetGenerationSeed();
+
+	/**
+	 * Called on the game thread to start an async generation. Returns a function to run on a background thread which generates
+	 * the layout as plain data. The function must not use the instance, or any UObject that the game thread may change meanwhile.
+	 * Instances that can't generate off the game thread return an empty function, and GenerateDungeonAsync generates synchronously.
+	 */
+	virtual TUniqueFunction<void(FSimpleGridLayoutData&)> MakeAsyncLayoutGenerator(int32 GenerationSeed);
+
+	/**
+	 * Called on the game thread with the layout data from an async generation, to store it as the layout for SpawnDungeon().
+	 */
+	virtual void ApplyLayoutData(const FSimpleGridLayoutData& LayoutData);
+
+	UPROPERTY()
+	USimpleGridDungeonLayout* Layout;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Static Meshes")
+	UStaticMesh* RoomFloorMesh;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Static Meshes")
+	bool bUseRandomFloorOrientation = false;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Static Meshes")
+	UStaticMesh* CorridorFloorMesh;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Static Meshes")
+	UStaticMesh* WallMesh;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Static Meshes")
+	UStaticMesh* DoorMesh;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Static Meshes")
+	UStaticMesh* PillarMesh;
+
+	/**
+	 * Spreads spawning over several frames in game worlds, adding the instances nearest the players first.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Time Slicing")
+	bool bTimeSlicedSpawning = false;
+	/**
+	 * How long a time-sliced spawn may spend adding instances each frame.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Time Slicing", meta=(EditCondition="bTimeSlicedSpawning", ClampMin=0.1, Units="ms"))
+	float SpawnBudgetMs = 2.0f;
+
+	/**
+	 * Regenerating compares the new layout with the spawned one, and only adds, removes or moves the instances that changed,
+	 * instead of clearing and respawning everything.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings")
+	bool bIncrementalRespawn = false;
+
+	/**
+	 * Splits the dungeon into square cells this many tiles wide, each with its own hierarchical instanced component per category,
+	 * so each cell is culled, rebuilt and enabled on its own. 0 keeps a single component per category for the whole dungeon.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Cells", meta=(ClampMin=0))
+	int32 CellSize = 0;
+
+	/**
+	 * In game worlds, or anywhere with bStreamOutsideGameWorlds, only spawns the cells near the players, and releases cells as the players move away. The layout is kept whole,
+	 * so cells can be spawned again when players come back. Needs CellSize to be set. Spawns are never time-sliced while streaming.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Streaming", meta=(EditCondition="CellSize > 0"))
+	bool bStreamCells = false;
+	/**
+	 * Cells closer than this to a player are spawned.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Streaming", meta=(EditCondition="bStreamCells", ClampMin=0, Units="cm"))
+	float StreamingLoadRadius = 5000.0f;
+	/**
+	 * Spawned cells further than this from every player are released. Kept above the load radius, so cells on the edge don't flicker in and out.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Streaming", meta=(EditCondition="bStreamCells", ClampMin=0, Units="cm"))
+	float StreamingUnloadRadius = 6000.0f;
+	/**
+	 * The most cells that can be spawned at once, keeping the nearest. 0 for no limit.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Streaming", meta=(EditCondition="bStreamCells", ClampMin=0))
+	int32 MaxLoadedCells = 0;
+	/**
+	 * Streams cells outside game worlds too, such as in the editor or in automation tests, where there are no players to stream around.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Streaming", meta=(EditCondition="bStreamCells"))
+	bool bStreamOutsideGameWorlds = false;
+	/**
+	 * Checks the players' locations for cells to stream every StreamingUpdateInterval. Turn off to drive streaming only through UpdateStreaming,
+	 * e.g. with simulated viewers, which the periodic update would otherwise replace.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Streaming", meta=(EditCondition="bStreamCells"))
+	bool bAutoUpdateStreaming = true;
+	/**
+	 * How often the players' locations are checked for cells to stream.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Settings|Streaming", meta=(EditCondition="bStreamCells && bAutoUpdateStreaming", ClampMin=0, Units="s"))
+	float StreamingUpdateInterval = 0.25f;
+
+	UPROPERTY()
+	UInstancedStaticMeshComponent* RoomFloorMeshISM;
+	UPROPERTY()
+	UInstancedStaticMeshComponent* CorridorFloorMeshISM;
+	UPROPERTY()
+	UInstancedStaticMeshComponent* WallMeshISM;
+	UPROPERTY()
+	UInstancedStaticMeshComponent* DoorMeshISM;
+	UPROPERTY()
+	UInstancedStaticMeshComponent* PillarMeshISM;
+
+	void SpawnRoomFloorTiles();
+	void SpawnCorridorFloorTiles();
+	void SpawnWallTiles();
+	void SpawnDoorTiles();
+	void SpawnCornerPillars();
+
+	/**
+	 * Clears the dungeon before a new layout is generated, unless bIncrementalRespawn is set, in which case the instances are kept to diff against.
+	 * Cancels any generation still running in the background, so its layout can't replace the new one.
+	 */
+	void PrepareForRespawn();
+
+	UInstancedStaticMeshComponent* GetCategoryComponent(EDungeonMeshCategory Category) const;
+
+	/**
+	 * Spawns a category's instances, split up by cell, or stores them for streaming. Keys identify each instance's grid position within
+	 * the category, and are used to match instances up with the ones already spawned, so only the differences are applied.
+	 */
+	void SubmitInstances(EDungeonMeshCategory Category, const TArray<uint64>& Keys);
+
+	/**
+	 * @return The transform of the instance with this key. Keys hold the whole grid position, so the layout isn't needed.
+	 */
+	FTransform MakeInstanceTransform(EDungeonMeshCategory Category, uint64 Key) const;
+
+	/**
+	 * Positions are relative to the dungeon actor, the space its components' instances are in, so the dungeon moves with the actor.
+	 */
+	FVector GetPositionForCoordinate(const FGridCoordinate& Coordinate) const;
+	FVector GetPositionForCorner(const FGridCorner& Corner) const;
+	FVector GetPositionForEdge(const FGridEdge& Edge) const;
+	FRotator GetRotationForEdge(const FGridEdge& Edge) const;
+
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
+
+private:
+	/**
+	 * Set when the async generation in flight is cancelled or superseded. Null when there is none.
+	 */
+	TSharedPtr<FThreadSafeBool, ESPMode::ThreadSafe> AsyncGenerationCancelled;
+
+	void FinishAsyncGeneration(const FSimpleGridLayoutData& LayoutData);
+
+	struct FPendingSpawnInstance
+	{
+		EDungeonMeshCategory Category;
+		uint64 CellKey;
+		uint64 Key;
+		FTransform Transform;
+		double DistanceSquared;
+	};
+
+	/**
+	 * The instances of one category within one cell: their component, and the key of every instance in instance index order.
+	 */
+	struct FInstanceBucket
+	{
+		UInstancedStaticMeshComponent* Component = nullptr;
+		TArray<uint64> InstanceKeys;
+	};
+
+	/**
+	 * Each category's buckets, by packed cell coordinate. Without cells, each category has one bucket using the category's own component.
+	 */
+	TMap<uint64, FInstanceBucket> SpawnedBuckets[static_cast<int32>(EDungeonMeshCategory::Num)];
+
+	/**
+	 * The components created for cells, kept here so they aren't garbage collected.
+	 */
+	UPROPERTY(Transient)
+	TArray<UHierarchicalInstancedStaticMeshComponent*> CellComponents;
+
+	/**
+	 * The cell size the current buckets were spawned with. Changing CellSize respawns everything on the next spawn.
+	 */
+	int32 SpawnedCellSize = 0;
+
+	TSet<uint64> DisabledCellKeys;
+
+	/**
+	 * @return The packed coordinate of the cell containing the instance with this key.
+	 */
+	uint64 GetCellKey(EDungeonMeshCategory Category, uint64 Key) const;
+
+	FInstanceBucket& FindOrAddBucket(EDungeonMeshCategory Category, uint64 CellKey);
+
+	/**
+	 * Removes a bucket's instances, destroying its component if it belongs to a cell.
+	 */
+	void ReleaseBucket(FInstanceBucket& Bucket);
+	void ReleaseAllBuckets();
+
+	void ApplyCellEnabled(UInstancedStaticMeshComponent* Component, EDungeonMeshCategory Category, bool bEnabled) const;
+
+	/**
+	 * Applies the difference between a cell's spawned instances and the new ones. With no new keys, the cell's bucket is released.
+	 */
+	void SubmitCellInstances(EDungeonMeshCategory Category, uint64 CellKey, const TArray<uint64>& Keys);
+
+	/**
+	 * The keys of every instance in a cell, by category. Keys are all that is kept of cells that aren't spawned.
+	 */
+	struct FStreamingCell
+	{
+		TArray<uint64> Keys[static_cast<int32>(EDungeonMeshCategory::Num)];
+	};
+
+	/**
+	 * Every cell of the streamed layout, by packed cell coordinate. Empty unless streaming.
+	 */
+	TMap<uint64, FStreamingCell> StreamingCells;
+	TSet<uint64> LoadedCellKeys;
+	bool bStreamingCells = false;
+
+	/**
+	 * Set when the layout has been respawned, so the cells that stay loaded are diffed against the new layout on the next update.
+	 */
+	bool bResubmitLoadedCells = false;
+	float StreamingUpdateCountdown = 0.0f;
+
+	/**
+	 * The viewer locations of the last streaming update, which a respawn streams around when streaming isn't updated automatically.
+	 */
+	TArray<FVector> LastViewerLocations;
+
+	void LoadStreamingCell(uint64 CellKey, const FStreamingCell& Cell);
+
+	/**
+	 * @return The squared horizontal distance from the cell to the nearest viewer. The viewer locations are relative to the dungeon.
+	 */
+	double GetCellDistanceSquared(uint64 CellKey, const TArray<FVector>& LocalViewerLocations) const;
+
+	/**
+	 * The instances of a time-sliced spawn, nearest the players first. Everything before NextPendingSpawnIndex has been added.
+	 */
+	TArray<FPendingSpawnInstance> PendingSpawnInstances;
+	int32 NextPendingSpawnIndex = 0;
+	bool bQueueSpawnInstances = false;
+
+	/**
+	 * Adds the instances to the cell's component now, or queues them if the current spawn is time-sliced.
+	 */
+	void AddSpawnInstances(EDungeonMeshCategory Category, uint64 CellKey, const TArray<uint64>& Keys, const TArray<FTransform>& Transforms);
+
+	/**
+	 * Adds queued instances in batches until the budget runs out or the queue is empty.
+	 */
+	void SpawnPendingInstances(double BudgetMs);
+	void FinishSpawning();
+	void CancelSpawning();
+
+	/**
+	 * @return The view locations of every player, or the dungeon's own location if there are no players.
+	 */
+	TArray<FVector> GetViewerLocations() const;
+
+	/**
+	 * @return World locations transformed to be relative to the dungeon, like the positions of its instances.
+	 */
+	TArray<FVector> GetLocalViewerLocations(const TArray<FVector>& ViewerLocations) const;
 };
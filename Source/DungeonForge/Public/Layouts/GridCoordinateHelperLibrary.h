@@ -39,19 +39,53 @@ struct FGridCoordinate
 		return Temp;
 	}
 
+	/**
+	 * Orders coordinates by their packed key, i.e. by X then Y.
+	 */
+	bool operator<(const FGridCoordinate& Other) const
+	{
+		return GetPackedKey() < Other.GetPackedKey();
+	}
+
+	/**
+	 * @return X and Y packed into a single 64-bit word. The sign bits are flipped so that comparing packed keys
+	 * orders coordinates by X then Y, which makes the key usable for both hashing and sorting.
+	 */
+	FORCEINLINE uint64 GetPackedKey() const
+	{
+		return (static_cast<uint64>(static_cast<uint32>(X) ^ 0x80000000u) << 32) | static_cast<uint64>(static_cast<uint32>(Y) ^ 0x80000000u);
+	}
+
+	static FORCEINLINE FGridCoordinate FromPackedKey(const uint64 PackedKey)
+	{
+		return FGridCoordinate(static_cast<int32>(static_cast<uint32>(PackedKey >> 32) ^ 0x80000000u), static_cast<int32>(static_cast<uint32>(PackedKey) ^ 0x80000000u));
+	}
+
 	float DistanceFromCentre() const;
 	FGridCoordinate Inverse() const;
 	
 	FGridCoordinate Rotate(int32 RotationCount) const;
 };
 
+/**
+ * Cheap 64 to 32 bit mixing hash for packed grid keys. Folds X into the low bits before multiplying so that
+ * both halves of the key influence the low bits TSet and TMap use for bucketing.
+ */
+FORCEINLINE uint32 HashPackedGridKey(uint64 PackedKey)
+{
+	PackedKey ^= PackedKey >> 32;
+	PackedKey *= 0xd6e8feb86659fd93ull;
+	PackedKey ^= PackedKey >> 32;
+	return static_cast<uint32>(PackedKey);
+}
+
 /**
  * @param Coordinate 
  * @return Generates hash for the grid coordinate. Required for TSet and TMap usage.
  */
 FORCEINLINE uint32 GetTypeHash(const FGridCoordinate& Coordinate)
 {
-	return FCrc::MemCrc32(&Coordinate, sizeof(Coordinate));
+	return HashPackedGridKey(Coordinate.GetPackedKey());
 }
 
 /**
@@ -99,10 +133,13 @@ struct FGridEdge
 /**
  * @param Edge 
  * @return Generates hash for the grid edge. Required for TSet and TMap usage.
+ * Independent of the order of the coordinates, matching operator== for undirected edges.
  */
 FORCEINLINE uint32 GetTypeHash(const FGridEdge& Edge)
 {
-	return FCrc::MemCrc32(&Edge, sizeof(Edge));
+	const uint64 KeyA = Edge.CoordinateA.GetPackedKey();
+	const uint64 KeyB = Edge.CoordinateB.GetPackedKey();
+	return HashCombineFast(HashPackedGridKey(FMath::Min(KeyA, KeyB)), HashPackedGridKey(FMath::Max(KeyA, KeyB)));
 }
 
 /**
@@ -144,6 +181,29 @@ struct FGridCorner
 	 * @return The grid corner formed by two perpendicular edges A and B. These edges should share a common tile.
 	 */
 	static FGridCorner FromEdges(const FGridEdge& EdgeA, const FGridEdge& EdgeB);
+
+	/**
+	 * @param BottomLeftTile The bottom-left of the four tiles around a grid vertex.
+	 * @return The grid corner made up of the four tiles around that vertex.
+	 */
+	static FGridCorner FromVertex(const FGridCoordinate& BottomLeftTile);
+
+	/**
+	 * Lookup table for whether a grid vertex is a corner, indexed by which of the four edges meeting at the vertex are walls.
+	 * The tiles around a vertex are numbered counter-clockwise from the bottom-left, and edge k lies between tile k and tile k+1.
+	 * A vertex is a corner when two perpendicular walls meet at it, which is when two consecutive edges are walls.
+	 */
+	static constexpr bool CornerFromEdgeMask[16] = {
+		false, false, false, true, false, false, true, true,
+		false, true, false, true, true, true, true, true };
+
+	/**
+	 * Lookup table for whether a grid vertex is a corner, indexed by which of the four tiles around it are floor.
+	 * Walls lie between floor and non-floor tiles, so straight runs of wall (two adjacent floor tiles) are not corners.
+	 */
+	static constexpr bool CornerFromTileMask[16] = {
+		false, true, true, false, true, true, false, true,
+		true, false, true, true, false, true, true, false };
 };
 
 /**
@@ -152,9 +212,44 @@ struct FGridCorner
  */
 FORCEINLINE uint32 GetTypeHash(const FGridCorner& Corner)
 {
-	return FCrc::MemCrc32(&Corner, sizeof(Corner));
+	uint32 Hash = HashCombineFast(GetTypeHash(Corner.CoordinateA), GetTypeHash(Corner.CoordinateB));
+	Hash = HashCombineFast(Hash, GetTypeHash(Corner.CoordinateC));
+	return HashCombineFast(Hash, GetTypeHash(Corner.CoordinateD));
 }
 
+/**
+ * A simple structure to define a rectilinear box.
+ * The box origin represents the top-left corner of the box.
+ * The box bound represents the bottom-right corner of the box. 
+ */
+USTRUCT()
+struct FRectBox
+{
+	GENERATED_BODY()
+
+	FRectBox();
+	FRectBox(const FGridCoordinate InBoxOrigin, const FGridCoordinate InBoxBound);
+	
+	FGridCoordinate BoxOrigin;
+	FGridCoordinate BoxBound;
+
+	int32 GetVolume() const;
+	int32 GetWidth() const { return BoxBound.X - BoxOrigin.X + 1; }
+	int32 GetHeight() const { return BoxBound.Y - BoxOrigin.Y + 1; }
+
+	/**
+	 * @return The longer of the box's width and height.
+	 */
+	int32 GetExtent() const { return FMath::Max(GetWidth(), GetHeight()); }
+
+	bool Contains(const FGridCoordinate& Coordinate) const
+	{
+		return Coordinate.X >= BoxOrigin.X && Coordinate.X <= BoxBound.X && Coordinate.Y >= BoxOrigin.Y && Coordinate.Y <= BoxBound.Y;
+	}
+
+	TArray<FGridCoordinate> GetFillCoordinates() const;
+};
+
 /**
  * A library of utility functions for working with grid coordinates in dungeon systems.
  */
@@ -164,6 +259,58 @@ class DUNGEONFORGE_API UGridCoordinateHelperLibrary : public UBlueprintFunctionL
 	GENERATED_BODY()
 
 public:
+	/**
+	 * Offsets to the neighbours of a coordinate, in the order GetAdjacentCoordinates returns them:
+	 * the orthogonal neighbours +X, -X, +Y, -Y first, followed by the diagonals.
+	 */
+	static constexpr int32 NumOrthogonalDirections = 4;
+	static constexpr int32 NumDirections = 8;
+	static constexpr int32 DirectionOffsetX[NumDirections] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+	static constexpr int32 DirectionOffsetY[NumDirections] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+	/**
+	 * Maps the Direction parameter used by GetAdjacentCoordinates and Expand (1 up, 2 right, 3 down, 4 left) to an index into the offset tables.
+	 */
+	static constexpr int32 DirectionIndexForSingleDirection[5] = { INDEX_NONE, 2, 0, 3, 1 };
+
+	/**
+	 * Calls Visitor with each neighbour of Coordinate, in the same order as GetAdjacentCoordinates, without allocating.
+	 */
+	template <typename FuncType>
+	static FORCEINLINE void ForEachAdjacentCoordinate(const FGridCoordinate& Coordinate, FuncType&& Visitor, const bool bIncludeDiagonal = false, const int32 Direction = 0)
+	{
+		if (Direction != 0)
+		{
+			if (Direction < 1 || Direction > 4) return;
+			const int32 DirectionIndex = DirectionIndexForSingleDirection[Direction];
+			Visitor(FGridCoordinate(Coordinate.X + DirectionOffsetX[DirectionIndex], Coordinate.Y + DirectionOffsetY[DirectionIndex]));
+			return;
+		}
+
+		const int32 NumVisited = bIncludeDiagonal ? NumDirections : NumOrthogonalDirections;
+		for (int32 DirectionIndex = 0; DirectionIndex < NumVisited; DirectionIndex++)
+		{
+			Visitor(FGridCoordinate(Coordinate.X + DirectionOffsetX[DirectionIndex], Coordinate.Y + DirectionOffsetY[DirectionIndex]));
+		}
+	}
+
+	/**
+	 * @return True if Predicate returns true for any neighbour of Coordinate. Stops at the first neighbour that matches.
+	 */
+	template <typename PredicateType>
+	static FORCEINLINE bool AnyAdjacentCoordinate(const FGridCoordinate& Coordinate, PredicateType&& Predicate, const bool bIncludeDiagonal = false)
+	{
+		const int32 NumVisited = bIncludeDiagonal ? NumDirections : NumOrthogonalDirections;
+		for (int32 DirectionIndex = 0; DirectionIndex < NumVisited; DirectionIndex++)
+		{
+			if (Predicate(FGridCoordinate(Coordinate.X + DirectionOffsetX[DirectionIndex], Coordinate.Y + DirectionOffsetY[DirectionIndex])))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
 	UFUNCTION(BlueprintPure)
 	static TArray<FGridCoordinate> GetAdjacentCoordinates(const FGridCoordinate& Coordinate, const bool bIncludeDiagonal = false, int32 Direction = 0);
 	
@@ -0,0 +1,111 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GridCoordinateHelperLibrary.h"
+
+/**
+ * A set of tiles stored as whole rectangles rather than individual tiles, so memory scales with the number of rectangles rather than their area.
+ * Each rectangle is indexed by the 64x64 tile chunks it overlaps, so tile lookups only test the rectangles nearby. The rectangles must not overlap.
+ */
+struct DUNGEONFORGE_API FGridRectSet
+{
+	static constexpr int32 ChunkShift = 6;
+
+	void Add(const FRectBox& Rect);
+	void Append(TConstArrayView<FRectBox> InRects);
+	bool Contains(const FGridCoordinate& Coordinate) const;
+
+	/**
+	 * @return The rectangle containing the coordinate, or nullptr if there is none.
+	 */
+	const FRectBox* FindRect(const FGridCoordinate& Coordinate) const;
+
+	/**
+	 * @return The number of tiles covered by the rectangles.
+	 */
+	int32 Num() const { return NumTiles; }
+	bool IsEmpty() const { return Rects.Num() == 0; }
+	void Reset();
+
+	TConstArrayView<FRectBox> GetRects() const { return Rects; }
+
+	/**
+	 * @return The heap memory used by the rectangles and their chunk index, in bytes.
+	 */
+	SIZE_T GetAllocatedSize() const;
+
+	/**
+	 * Calls Visitor with every tile of every rectangle.
+	 */
+	template <typename FuncType>
+	void ForEach(FuncType&& Visitor) const
+	{
+		for (const FRectBox& Rect : Rects)
+		{
+			for (int32 Y = Rect.BoxOrigin.Y; Y <= Rect.BoxBound.Y; Y++)
+			{
+				for (int32 X = Rect.BoxOrigin.X; X <= Rect.BoxBound.X; X++)
+				{
+					Visitor(FGridCoordinate(X, Y));
+				}
+			}
+		}
+	}
+
+	/**
+	 * Calls Visitor(Tile, Neighbour) for every tile on the edge of a rectangle and each of its neighbours outside that rectangle.
+	 * Only walks the perimeters, so it is linear in the total perimeter rather than the area.
+	 */
+	template <typename FuncType>
+	void ForEachBoundaryEdge(FuncType&& Visitor) const
+	{
+		for (const FRectBox& Rect : Rects)
+		{
+			for (int32 X = Rect.BoxOrigin.X; X <= Rect.BoxBound.X; X++)
+			{
+				Visitor(FGridCoordinate(X, Rect.BoxOrigin.Y), FGridCoordinate(X, Rect.BoxOrigin.Y - 1));
+				Visitor(FGridCoordinate(X, Rect.BoxBound.Y), FGridCoordinate(X, Rect.BoxBound.Y + 1));
+			}
+			for (int32 Y = Rect.BoxOrigin.Y; Y <= Rect.BoxBound.Y; Y++)
+			{
+				Visitor(FGridCoordinate(Rect.BoxOrigin.X, Y), FGridCoordinate(Rect.BoxOrigin.X - 1, Y));
+				Visitor(FGridCoordinate(Rect.BoxBound.X, Y), FGridCoordinate(Rect.BoxBound.X + 1, Y));
+			}
+		}
+	}
+
+	/**
+	 * Calls Visitor(BottomLeftTile) for every grid vertex on the perimeter of a rectangle, once per rectangle.
+	 * As with FGridCorner::FromVertex, a vertex is identified by the bottom-left of the four tiles around it.
+	 */
+	template <typename FuncType>
+	void ForEachBoundaryVertex(FuncType&& Visitor) const
+	{
+		for (const FRectBox& Rect : Rects)
+		{
+			// The bottom and top rows of vertices include the rectangle's corners, so the sides skip them
+			for (int32 X = Rect.BoxOrigin.X - 1; X <= Rect.BoxBound.X; X++)
+			{
+				Visitor(FGridCoordinate(X, Rect.BoxOrigin.Y - 1));
+				Visitor(FGridCoordinate(X, Rect.BoxBound.Y));
+			}
+			for (int32 Y = Rect.BoxOrigin.Y; Y < Rect.BoxBound.Y; Y++)
+			{
+				Visitor(FGridCoordinate(Rect.BoxOrigin.X - 1, Y));
+				Visitor(FGridCoordinate(Rect.BoxBound.X, Y));
+			}
+		}
+	}
+
+private:
+	TArray<FRectBox> Rects;
+
+	/**
+	 * The indices of the rectangles overlapping each chunk, keyed by the chunk's packed coordinate.
+	 */
+	TMap<uint64, TArray<int32>> ChunkRects;
+
+	int32 NumTiles = 0;
+};
@@ -0,0 +1,231 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GridCoordinateHelperLibrary.h"
+
+/**
+ * A sparse set of grid coordinates, stored as a hash of 64x64 tile chunks with one bit per tile.
+ * Each chunk holds one 64-bit word per row, so membership tests, iteration and unions work on whole rows at a time.
+ */
+struct DUNGEONFORGE_API FGridTileBitmap
+{
+	static constexpr int32 ChunkShift = 6;
+	static constexpr int32 ChunkSize = 1 << ChunkShift;
+	static constexpr int32 ChunkMask = ChunkSize - 1;
+
+	/**
+	 * A 64x64 block of tiles. The row index is the local Y coordinate and the bit index is the local X coordinate.
+	 */
+	struct FChunk
+	{
+		uint64 Rows[ChunkSize] = {};
+	};
+
+	/**
+	 * @return True if the coordinate was not already in the bitmap.
+	 */
+	bool Add(const FGridCoordinate& Coordinate);
+	void Append(TConstArrayView<FGridCoordinate> Coordinates);
+	bool Contains(const FGridCoordinate& Coordinate) const;
+
+	/**
+	 * @return The 64 tiles of row Y starting at X, with bit i set if tile X + i is in the bitmap. Reads across a chunk boundary if needed.
+	 */
+	uint64 GetRowBits(int32 X, int32 Y) const;
+
+	/**
+	 * Tests a footprint given as row masks against the bitmap, one 64-bit AND per row, stopping at the first overlapping row.
+	 * Bit i of RowMasks[r] is the tile at (BottomLeft.X + i, BottomLeft.Y + r).
+	 * @return True if any tile of the footprint is in the bitmap.
+	 */
+	bool IntersectsRows(TConstArrayView<uint64> RowMasks, const FGridCoordinate& BottomLeft) const;
+
+	/**
+	 * Adds every tile of Other to this bitmap, one row word at a time.
+	 */
+	void Union(const FGridTileBitmap& Other);
+
+	/**
+	 * Adds every tile of Other, moved by Offset, to this bitmap. Each source row is shifted into at most two destination words.
+	 * Repeated translated unions give Minkowski sums of tile sets without visiting tiles individually.
+	 */
+	void UnionTranslated(const FGridTileBitmap& Other, const FGridCoordinate& Offset);
+
+	/**
+	 * Removes every tile of Other from this bitmap, one row word at a time.
+	 */
+	void Difference(const FGridTileBitmap& Other);
+
+	int32 Num() const { return NumTiles; }
+	bool IsEmpty() const { return NumTiles == 0; }
+	void Reset();
+
+	TArray<FGridCoordinate> Array() const;
+
+	/**
+	 * @return The heap memory used by the chunk storage, in bytes.
+	 */
+	SIZE_T GetAllocatedSize() const;
+
+	/**
+	 * Calls Visitor with every coordinate in the bitmap. Visits chunk by chunk, row by row.
+	 */
+	template <typename FuncType>
+	void ForEach(FuncType&& Visitor) const
+	{
+		for (const TPair<uint64, FChunk>& Pair : Chunks)
+		{
+			const FGridCoordinate ChunkOrigin = GetChunkOrigin(Pair.Key);
+			for (int32 LocalY = 0; LocalY < ChunkSize; LocalY++)
+			{
+				const int32 Y = ChunkOrigin.Y + LocalY;
+				VisitRowBits(Pair.Value.Rows[LocalY], ChunkOrigin.X, [&](const int32 X) { Visitor(FGridCoordinate(X, Y)); });
+			}
+		}
+	}
+
+	/**
+	 * Per-row masks of the tiles in a chunk whose neighbour in each direction is not in the bitmap.
+	 */
+	struct FBoundaryMasks
+	{
+		uint64 East[ChunkSize];
+		uint64 West[ChunkSize];
+		uint64 North[ChunkSize];
+		uint64 South[ChunkSize];
+	};
+
+	/**
+	 * Calls Visitor(Tile, Neighbour) for every tile with an orthogonal neighbour that is not in the bitmap.
+	 * Each such pair is visited exactly once, so this is linear in the number of chunks rather than needing a set to deduplicate.
+	 */
+	template <typename FuncType>
+	void ForEachBoundaryEdge(FuncType&& Visitor) const
+	{
+		FBoundaryMasks Masks;
+		for (const TPair<uint64, FChunk>& Pair : Chunks)
+		{
+			ComputeBoundaryMasks(Pair.Key, Pair.Value, Masks);
+
+			const FGridCoordinate ChunkOrigin = GetChunkOrigin(Pair.Key);
+			for (int32 LocalY = 0; LocalY < ChunkSize; LocalY++)
+			{
+				const int32 Y = ChunkOrigin.Y + LocalY;
+				VisitRowBits(Masks.East[LocalY], ChunkOrigin.X, [&](const int32 X) { Visitor(FGridCoordinate(X, Y), FGridCoordinate(X + 1, Y)); });
+				VisitRowBits(Masks.West[LocalY], ChunkOrigin.X, [&](const int32 X) { Visitor(FGridCoordinate(X, Y), FGridCoordinate(X - 1, Y)); });
+				VisitRowBits(Masks.North[LocalY], ChunkOrigin.X, [&](const int32 X) { Visitor(FGridCoordinate(X, Y), FGridCoordinate(X, Y + 1)); });
+				VisitRowBits(Masks.South[LocalY], ChunkOrigin.X, [&](const int32 X) { Visitor(FGridCoordinate(X, Y), FGridCoordinate(X, Y - 1)); });
+			}
+		}
+	}
+
+	/**
+	 * Calls Visitor(BottomLeftTile, TileMask) for every grid vertex that touches both a tile in the bitmap and a tile outside it.
+	 * A vertex is identified by the bottom-left of the four tiles around it. Bit 0 of TileMask is the bottom-left tile,
+	 * then bottom-right, top-right and top-left, i.e. counter-clockwise around the vertex.
+	 */
+	template <typename FuncType>
+	void ForEachBoundaryVertex(FuncType&& Visitor) const
+	{
+		// A vertex can touch tiles in its own chunk and the chunks to its right, above and above-right,
+		// so every chunk with tiles needs the vertices of itself and the chunks to its left and below visiting.
+		TSet<uint64> VertexChunkKeys;
+		VertexChunkKeys.Reserve(Chunks.Num() * 4);
+		for (const TPair<uint64, FChunk>& Pair : Chunks)
+		{
+			const FGridCoordinate ChunkCoordinate = FGridCoordinate::FromPackedKey(Pair.Key);
+			VertexChunkKeys.Add(Pair.Key);
+			VertexChunkKeys.Add(GetChunkKey(ChunkCoordinate.X - 1, ChunkCoordinate.Y));
+			VertexChunkKeys.Add(GetChunkKey(ChunkCoordinate.X, ChunkCoordinate.Y - 1));
+			VertexChunkKeys.Add(GetChunkKey(ChunkCoordinate.X - 1, ChunkCoordinate.Y - 1));
+		}
+
+		for (const uint64 ChunkKey : VertexChunkKeys)
+		{
+			const FGridCoordinate ChunkCoordinate = FGridCoordinate::FromPackedKey(ChunkKey);
+			const FGridCoordinate ChunkOrigin = GetChunkOrigin(ChunkKey);
+			const uint64* Rows = FindChunkOrEmpty(ChunkCoordinate.X, ChunkCoordinate.Y).Rows;
+			const uint64* RightRows = FindChunkOrEmpty(ChunkCoordinate.X + 1, ChunkCoordinate.Y).Rows;
+			const uint64* AboveRows = FindChunkOrEmpty(ChunkCoordinate.X, ChunkCoordinate.Y + 1).Rows;
+			const uint64* AboveRightRows = FindChunkOrEmpty(ChunkCoordinate.X + 1, ChunkCoordinate.Y + 1).Rows;
+
+			for (int32 LocalY = 0; LocalY < ChunkSize; LocalY++)
+			{
+				const bool bTopRow = LocalY == ChunkSize - 1;
+				const uint64 NextRow = bTopRow ? AboveRows[0] : Rows[LocalY + 1];
+				const uint64 NextRightRow = bTopRow ? AboveRightRows[0] : RightRows[LocalY + 1];
+
+				// Bit i of each word is the corresponding tile around vertex i of this row
+				const uint64 BottomLeft = Rows[LocalY];
+				const uint64 BottomRight = (Rows[LocalY] >> 1) | (RightRows[LocalY] << (ChunkSize - 1));
+				const uint64 TopLeft = NextRow;
+				const uint64 TopRight = (NextRow >> 1) | (NextRightRow << (ChunkSize - 1));
+
+				const uint64 Boundary = (BottomLeft | BottomRight | TopLeft | TopRight) & ~(BottomLeft & BottomRight & TopLeft & TopRight);
+				const int32 Y = ChunkOrigin.Y + LocalY;
+				VisitRowBits(Boundary, 0, [&](const int32 LocalX)
+				{
+					const uint8 TileMask = static_cast<uint8>(((BottomLeft >> LocalX) & 1) | (((BottomRight >> LocalX) & 1) << 1) | (((TopRight >> LocalX) & 1) << 2) | (((TopLeft >> LocalX) & 1) << 3));
+					Visitor(FGridCoordinate(ChunkOrigin.X + LocalX, Y), TileMask);
+				});
+			}
+		}
+	}
+
+	/**
+	 * Computes the boundary masks of a single chunk of this bitmap, shifting each row against its neighbouring rows and chunks
+	 * to test 64 tiles at once.
+	 */
+	void ComputeBoundaryMasks(const uint64 ChunkKey, const FChunk& Chunk, FBoundaryMasks& OutMasks) const;
+
+	/**
+	 * Calls Visitor with RowOriginX plus the index of every set bit in Row.
+	 */
+	template <typename FuncType>
+	static FORCEINLINE void VisitRowBits(uint64 Row, const int32 RowOriginX, FuncType&& Visitor)
+	{
+		while (Row != 0)
+		{
+			const int32 LocalX = static_cast<int32>(FMath::CountTrailingZeros64(Row));
+			Row &= Row - 1;
+			Visitor(RowOriginX + LocalX);
+		}
+	}
+
+	const FChunk* FindChunk(const int32 ChunkX, const int32 ChunkY) const
+	{
+		return Chunks.Find(GetChunkKey(ChunkX, ChunkY));
+	}
+
+	/**
+	 * @return The chunk at the given chunk coordinate, or a shared all-empty chunk if there is none.
+	 */
+	const FChunk& FindChunkOrEmpty(const int32 ChunkX, const int32 ChunkY) const;
+
+	const TMap<uint64, FChunk>& GetChunks() const { return Chunks; }
+
+	static FORCEINLINE uint64 GetChunkKey(const int32 ChunkX, const int32 ChunkY)
+	{
+		return FGridCoordinate(ChunkX, ChunkY).GetPackedKey();
+	}
+
+	/**
+	 * @return The global coordinate of the tile at local (0, 0) of the chunk.
+	 */
+	static FORCEINLINE FGridCoordinate GetChunkOrigin(const uint64 ChunkKey)
+	{
+		const FGridCoordinate ChunkCoordinate = FGridCoordinate::FromPackedKey(ChunkKey);
+		return FGridCoordinate(ChunkCoordinate.X * ChunkSize, ChunkCoordinate.Y * ChunkSize);
+	}
+
+private:
+	/**
+	 * ORs Bits into the row at global Y of the chunk column ChunkX, creating the chunk if needed.
+	 */
+	void OrRowBits(const int32 ChunkX, const int32 Y, const uint64 Bits);
+
+	TMap<uint64, FChunk> Chunks;
+	int32 NumTiles = 0;
+};
@@ -4,9 +4,48 @@
 
 #include "CoreMinimal.h"
 #include "GridCoordinateHelperLibrary.h"
+#include "GridRectSet.h"
+#include "GridTileBitmap.h"
 #include "UObject/Object.h"
 #include "SimpleGridDungeonLayout.generated.h"
 
+class USimpleGridDungeonLayout;
+
+/**
+ * A layout as plain data, with no UObject, so it can be generated and passed around on any thread.
+ * Converted to a USimpleGridDungeonLayout with CreateLayout only when one is needed.
+ */
+struct DUNGEONFORGE_API FSimpleGridLayoutData
+{
+	/**
+	 * The seed the layout was generated with.
+	 */
+	int32 Seed = 0;
+
+	TArray<FGridCoordinate> RoomTiles;
+	TArray<FGridCoordinate> CorridorTiles;
+
+	/**
+	 * Whole rectangles of room and corridor tiles, kept as rectangles all the way into the layout. They must not overlap each other or the tiles above.
+	 */
+	TArray<FRectBox> RoomRects;
+	TArray<FRectBox> CorridorRects;
+
+	TArray<FGridEdge> Walls;
+	TArray<FGridEdge> Doors;
+	bool bImputesWallPositions = true;
+
+	/**
+	 * Clears the data, keeping the allocations for reuse.
+	 */
+	void Reset();
+
+	/**
+	 * Creates a layout object holding a copy of this data. Call on the game thread.
+	 */
+	USimpleGridDungeonLayout* CreateLayout(UObject* Outer = GetTransientPackage()) const;
+};
+
 /**
  * A simple dungeon layout, composed of just tiles and doors.
  */
@@ -30,6 +69,37 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Layout Data")
 	TArray<FGridCoordinate> GetAllFloorTiles() const;
 	
+	/**
+	 * @return The number of room and corridor tiles, without materialising them.
+	 */
+	int32 GetNumFloorTiles() const;
+
+	/**
+	 * Calls Visitor with every room tile, whether it was added as a tile or as part of a rectangle, without building an array of them.
+	 */
+	template <typename FuncType>
+	void ForEachRoomTile(FuncType&& Visitor) const
+	{
+		RoomTiles.ForEach(Visitor);
+		RoomRects.ForEach(Visitor);
+	}
+
+	template <typename FuncType>
+	void ForEachCorridorTile(FuncType&& Visitor) const
+	{
+		CorridorTiles.ForEach(Visitor);
+		CorridorRects.ForEach(Visitor);
+	}
+	
+	UFUNCTION(BlueprintCallable, Category = "Layout Data")
+	bool IsRoomTile(const FGridCoordinate& Coordinate) const;
+
+	UFUNCTION(BlueprintCallable, Category = "Layout Data")
+	bool IsCorridorTile(const FGridCoordinate& Coordinate) const;
+
+	UFUNCTION(BlueprintCallable, Category = "Layout Data")
+	bool IsFloorTile(const FGridCoordinate& Coordinate) const;
+	
 	UFUNCTION(BlueprintCallable, Category = "Layout Data")
 	TArray<FGridEdge> GetDoorPositions(const float GridSize) const;
 	
@@ -42,10 +112,30 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Layout Data")
 	TArray<FGridCorner> GetCornerPillarPositions(const float GridSize) const;
 
+	/**
+	 * Non-copying views of the door, wall and corner pillar positions. These are derived at most once per change to the layout
+	 * and stay valid until the layout is next modified. Not safe to call from several threads at once.
+	 */
+	TConstArrayView<FGridEdge> ViewDoorPositions() const;
+	TConstArrayView<FGridEdge> ViewWallPositions() const;
+	TConstArrayView<FGridCorner> ViewCornerPillarPositions() const;
+
+	/**
+	 * @return A counter which changes whenever tiles, walls or doors are added to the layout.
+	 */
+	uint32 GetVersion() const { return Version; }
+
 	UFUNCTION()
 	void AddRoomTiles(const TArray<FGridCoordinate>& InRoomTiles);
 	UFUNCTION()
 	void AddCorridorTiles(const TArray<FGridCoordinate>& InCorridorTiles);
+	/**
+	 * Adds whole rectangles of tiles, which are stored as rectangles rather than tiles. They must not overlap each other or any existing tiles.
+	 */
+	UFUNCTION()
+	void AddRoomRects(const TArray<FRectBox>& InRoomRects);
+	UFUNCTION()
+	void AddCorridorRects(const TArray<FRectBox>& InCorridorRects);
 	UFUNCTION()
 	void AddWalls(const TArray<FGridEdge>& InWallLocations);
 	UFUNCTION()
@@ -56,10 +146,49 @@ public:
 	UPROPERTY()
 	bool bImputesCornerPillarPositions = true;
 
+	/**
+	 * @return The heap memory used to store the room and corridor tiles, in bytes.
+	 */
+	SIZE_T GetTileAllocatedSize() const;
+
 protected:
-	TSet<FGridCoordinate> RoomTiles;
-	TSet<FGridCoordinate> CorridorTiles;
+	FGridTileBitmap RoomTiles;
+	FGridTileBitmap CorridorTiles;
+	FGridRectSet RoomRects;
+	FGridRectSet CorridorRects;
 	TSet<FGridEdge> Walls;
 	TSet<FGridEdge> Doors;
 	TSet<FGridCorner> CornerPillars;
+
+	uint32 Version = 1;
+
+	/**
+	 * Derived data is stamped with the layout version and the imputation flags it was built with, and rebuilt when either changes.
+	 */
+	uint64 GetDerivedDataStamp() const;
+
+	/**
+	 * @return The room and corridor tiles that were added as tiles. Tiles in rectangles are never materialised.
+	 */
+	const FGridTileBitmap& GetCachedFloorTiles() const;
+
+	bool HasRects() const { return !RoomRects.IsEmpty() || !CorridorRects.IsEmpty(); }
+	bool IsRectTile(const FGridCoordinate& Coordinate) const { return RoomRects.Contains(Coordinate) || CorridorRects.Contains(Coordinate); }
+
+	/**
+	 * @return Which of the four tiles around a vertex are floor, in the bit order of FGridCorner::CornerFromTileMask.
+	 */
+	uint8 GetFloorTileMask(const FGridCoordinate& BottomLeftTile) const;
+	
+	void ComputeWallPositions(TArray<FGridEdge>& OutWallPositions) const;
+	void ComputeCornerPillarPositions(TArray<FGridCorner>& OutCornerPillarPositions) const;
+
+	mutable FGridTileBitmap CachedFloorTiles;
+	mutable TArray<FGridEdge> CachedDoorPositions;
+	mutable TArray<FGridEdge> CachedWallPositions;
+	mutable TArray<FGridCorner> CachedCornerPillarPositions;
+	mutable uint64 CachedFloorTilesStamp = 0;
+	mutable uint64 CachedDoorPositionsStamp = 0;
+	mutable uint64 CachedWallPositionsStamp = 0;
+	mutable uint64 CachedCornerPillarPositionsStamp = 0;
 };